@@ -0,0 +1,693 @@
+#include "CpuRayCast.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#    define CPU_RAY_CAST_X86
+#    include <immintrin.h>
+#    ifdef _MSC_VER
+#        include <intrin.h>
+// MSVC accepts intrinsics of any instruction set without changing the target
+#        define CPU_RAY_CAST_SSE_TARGET
+#        define CPU_RAY_CAST_AVX2_TARGET
+#    else
+#        define CPU_RAY_CAST_SSE_TARGET __attribute__((target("sse2")))
+#        define CPU_RAY_CAST_AVX2_TARGET __attribute__((target("avx2")))
+#    endif
+#endif
+
+static_assert(sizeof(CpuBvh8Node) == 104, "CpuBvh8Node is expected to stay compressed");
+
+// enough for 7 pushed siblings per level of a BVH8 collapsed from the 64 levels of a CpuBvh
+const uint32_t bvh8StackSize = 512;
+
+// direction components closer to zero than this are clamped, so quantized planes times the
+// inverse direction stay finite
+const float bvh8MinDirection = 1e-18f;
+
+// a binary node that still has to become an 8-wide node
+struct Bvh8CollapseTask {
+    uint32_t binaryNode = 0;
+    uint32_t node = 0;
+};
+
+static float GetNodeHalfArea(const CpuBvhNode& node) {
+    const float x = node.boundsMax[0] - node.boundsMin[0];
+    const float y = node.boundsMax[1] - node.boundsMin[1];
+    const float z = node.boundsMax[2] - node.boundsMin[2];
+    return x * y + y * z + z * x;
+}
+
+// child bounds are rounded outwards, so a child never gets smaller than its real bounds
+static void QuantizeChildBounds(const CpuBvh& bvh,
+                                const uint32_t* binaryChildren,
+                                uint32_t childCount,
+                                CpuBvh8Node& node) {
+    uint8_t* lower[3] = {node.lowerX, node.lowerY, node.lowerZ};
+    uint8_t* upper[3] = {node.upperX, node.upperY, node.upperZ};
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        float boundsMin = std::numeric_limits<float>::max();
+        float boundsMax = -std::numeric_limits<float>::max();
+        for (uint32_t ii = 0; ii < childCount; ++ii) {
+            const CpuBvhNode& child = bvh.nodes[binaryChildren[ii]];
+            boundsMin = std::min(boundsMin, child.boundsMin[axis]);
+            boundsMax = std::max(boundsMax, child.boundsMax[axis]);
+        };
+
+        // 254 steps leave one step of headroom for rounding at the upper end
+        const float extent = boundsMax - boundsMin;
+        const float scale =
+            extent > 0.0f ? std::ldexp(1.0f, (int)std::ceil(std::log2(extent / 254.0f))) : 0.0f;
+        node.origin[axis] = boundsMin;
+        node.scale[axis] = scale;
+        if (scale == 0.0f) {
+            continue;
+        }
+
+        for (uint32_t ii = 0; ii < childCount; ++ii) {
+            const CpuBvhNode& child = bvh.nodes[binaryChildren[ii]];
+            float low = std::floor((child.boundsMin[axis] - boundsMin) / scale);
+            float high = std::ceil((child.boundsMax[axis] - boundsMin) / scale);
+            low = std::min(std::max(low, 0.0f), 255.0f);
+            high = std::min(std::max(high, 0.0f), 255.0f);
+            while (low > 0.0f && boundsMin + low * scale > child.boundsMin[axis]) {
+                low -= 1.0f;
+            };
+            while (high < 255.0f && boundsMin + high * scale < child.boundsMax[axis]) {
+                high += 1.0f;
+            };
+            lower[axis][ii] = (uint8_t)low;
+            upper[axis][ii] = (uint8_t)high;
+        };
+    };
+}
+
+// packs the triangles of a binary leaf 8 at a time and returns the leaf child reference
+static uint32_t AddLeaf(const CpuBvh& bvh, const CpuBvhNode& binaryLeaf, CpuBvh8& out) {
+    CpuBvh8Leaf leaf;
+    leaf.firstPack = (uint32_t)out.packs.size();
+    leaf.packCount = (binaryLeaf.primitiveCount + 7) / 8;
+    for (uint32_t ii = 0; ii < binaryLeaf.primitiveCount; ii += 8) {
+        CpuTrianglePack pack;
+        for (uint32_t lane = 0; lane < 8; ++lane) {
+            pack.primitiveIndices[lane] = cpuRayMiss;
+            if (ii + lane >= binaryLeaf.primitiveCount) {
+                continue;
+            }
+            const uint32_t triangleIndex = binaryLeaf.firstChildOrPrimitive + ii + lane;
+            const CpuTriangle& triangle = bvh.triangles[triangleIndex];
+            for (uint32_t axis = 0; axis < 3; ++axis) {
+                pack.v0[axis][lane] = triangle.v0[axis];
+                pack.edge1[axis][lane] = triangle.edge1[axis];
+                pack.edge2[axis][lane] = triangle.edge2[axis];
+            };
+            pack.primitiveIndices[lane] = bvh.primitiveIndices[triangleIndex];
+        };
+        out.packs.push_back(pack);
+    };
+    out.leaves.push_back(leaf);
+    return cpuBvh8LeafBit | (uint32_t)(out.leaves.size() - 1);
+}
+
+void BuildCpuBvh8(const CpuBvh& bvh, CpuBvh8& out) {
+    out = {};
+    out.nodes.emplace_back();
+    for (uint32_t& child : out.nodes[0].children) {
+        child = cpuBvh8EmptyChild;
+    };
+    if (bvh.triangles.empty()) {
+        return;
+    }
+
+    std::vector<Bvh8CollapseTask> tasks;
+    tasks.push_back({0, 0});
+    while (!tasks.empty()) {
+        const Bvh8CollapseTask task = tasks.back();
+        tasks.pop_back();
+
+        // keep opening the largest inner child until 8 children are collected
+        uint32_t binaryChildren[8] = {};
+        uint32_t childCount = 0;
+        const CpuBvhNode& binaryNode = bvh.nodes[task.binaryNode];
+        if (binaryNode.primitiveCount > 0) {
+            binaryChildren[childCount++] = task.binaryNode;
+        } else {
+            binaryChildren[childCount++] = binaryNode.firstChildOrPrimitive;
+            binaryChildren[childCount++] = binaryNode.firstChildOrPrimitive + 1;
+        }
+        while (childCount < 8) {
+            uint32_t largest = childCount;
+            float largestArea = -1.0f;
+            for (uint32_t ii = 0; ii < childCount; ++ii) {
+                const CpuBvhNode& child = bvh.nodes[binaryChildren[ii]];
+                if (child.primitiveCount == 0 && GetNodeHalfArea(child) > largestArea) {
+                    largest = ii;
+                    largestArea = GetNodeHalfArea(child);
+                }
+            };
+            if (largest == childCount) {
+                break;
+            }
+            const uint32_t opened = bvh.nodes[binaryChildren[largest]].firstChildOrPrimitive;
+            binaryChildren[largest] = opened;
+            binaryChildren[childCount++] = opened + 1;
+        };
+
+        // nodes are appended below, so the node is filled as a copy
+        CpuBvh8Node node;
+        QuantizeChildBounds(bvh, binaryChildren, childCount, node);
+        for (uint32_t ii = 0; ii < 8; ++ii) {
+            if (ii >= childCount) {
+                node.children[ii] = cpuBvh8EmptyChild;
+                continue;
+            }
+            const CpuBvhNode& child = bvh.nodes[binaryChildren[ii]];
+            if (child.primitiveCount > 0) {
+                node.children[ii] = AddLeaf(bvh, child, out);
+            } else {
+                node.children[ii] = (uint32_t)out.nodes.size();
+                out.nodes.emplace_back();
+                tasks.push_back({binaryChildren[ii], node.children[ii]});
+            }
+        };
+        out.nodes[task.node] = node;
+    };
+}
+
+struct Bvh8RayContext {
+    float origin[3] = {};
+    float direction[3] = {};
+    float inverseDirection[3] = {};
+    // the upper planes are the near ones on axes the ray travels along negatively
+    bool negative[3] = {};
+    float tMin = 0.0f;
+    float tMax = 0.0f;
+};
+
+static Bvh8RayContext GetRayContext(const CpuRayQuery& ray) {
+    Bvh8RayContext out;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        const float direction = ray.direction[axis];
+        out.origin[axis] = ray.origin[axis];
+        out.direction[axis] = direction;
+        out.inverseDirection[axis] =
+            1.0f / (std::fabs(direction) < bvh8MinDirection
+                        ? std::copysign(bvh8MinDirection, direction)
+                        : direction);
+        out.negative[axis] = out.inverseDirection[axis] < 0.0f;
+    };
+    out.tMin = ray.tMin;
+    out.tMax = ray.tMax;
+    return out;
+}
+
+static float GetHitTMax(const Bvh8RayContext& ray, const CpuRayQueryHit& hit) {
+    return hit.primitiveIndex != cpuRayMiss ? hit.t : ray.tMax;
+}
+
+struct Bvh8StackEntry {
+    uint32_t child = 0;
+    float entry = 0.0f;
+};
+
+struct Bvh8Stack {
+    Bvh8StackEntry entries[bvh8StackSize];
+    uint32_t size = 0;
+};
+
+// skips entries the ray enters behind the closest hit found since they were pushed
+static bool PopChild(Bvh8Stack& stack, float tMax, uint32_t& outChild) {
+    while (stack.size > 0) {
+        const Bvh8StackEntry& entry = stack.entries[--stack.size];
+        if (entry.entry <= tMax) {
+            outChild = entry.child;
+            return true;
+        }
+    };
+    return false;
+}
+
+// pushes the hit children far to near, so the nearest one is popped first
+static void PushChildren(Bvh8Stack& stack,
+                         const CpuBvh8Node& node,
+                         uint32_t hitMask,
+                         const float entries[8]) {
+    const uint32_t first = stack.size;
+    for (uint32_t ii = 0; ii < 8; ++ii) {
+        if ((hitMask & (1u << ii)) == 0) {
+            continue;
+        }
+        Bvh8StackEntry entry = {node.children[ii], entries[ii]};
+        uint32_t position = stack.size++;
+        for (; position > first && stack.entries[position - 1].entry < entry.entry; --position) {
+            stack.entries[position] = stack.entries[position - 1];
+        };
+        stack.entries[position] = entry;
+    };
+}
+
+static uint32_t IntersectNodeScalar(const CpuBvh8Node& node,
+                                    const Bvh8RayContext& ray,
+                                    float tMax,
+                                    float outEntries[8]) {
+    const uint8_t* lower[3] = {node.lowerX, node.lowerY, node.lowerZ};
+    const uint8_t* upper[3] = {node.upperX, node.upperY, node.upperZ};
+    float entries[8];
+    float exits[8];
+    for (uint32_t ii = 0; ii < 8; ++ii) {
+        entries[ii] = ray.tMin;
+        exits[ii] = tMax;
+    };
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        const float a = node.scale[axis] * ray.inverseDirection[axis];
+        const float b = (node.origin[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+        const uint8_t* nearPlanes = ray.negative[axis] ? upper[axis] : lower[axis];
+        const uint8_t* farPlanes = ray.negative[axis] ? lower[axis] : upper[axis];
+        for (uint32_t ii = 0; ii < 8; ++ii) {
+            entries[ii] = std::max(entries[ii], (float)nearPlanes[ii] * a + b);
+            exits[ii] = std::min(exits[ii], (float)farPlanes[ii] * a + b);
+        };
+    };
+
+    uint32_t hitMask = 0;
+    for (uint32_t ii = 0; ii < 8; ++ii) {
+        outEntries[ii] = entries[ii];
+        if (node.children[ii] != cpuBvh8EmptyChild && entries[ii] <= exits[ii]) {
+            hitMask |= 1u << ii;
+        }
+    };
+    return hitMask;
+}
+
+// keeps the closest lane of hitMask, the lowest one on ties, if any lane hit at all
+static void ResolvePackHit(const CpuTrianglePack& pack,
+                           uint32_t hitMask,
+                           const float t[8],
+                           const float u[8],
+                           const float v[8],
+                           CpuRayQueryHit& hit) {
+    uint32_t closest = 8;
+    for (uint32_t lane = 0; lane < 8; ++lane) {
+        if ((hitMask & (1u << lane)) != 0 && (closest == 8 || t[lane] < t[closest])) {
+            closest = lane;
+        }
+    };
+    if (closest == 8) {
+        return;
+    }
+    hit.t = t[closest];
+    hit.u = u[closest];
+    hit.v = v[closest];
+    hit.primitiveIndex = pack.primitiveIndices[closest];
+}
+
+// Moller-Trumbore without culling, the same operations in the same order as the wide kernels
+static void IntersectPackScalar(const CpuTrianglePack& pack,
+                                const Bvh8RayContext& ray,
+                                CpuRayQueryHit& hit) {
+    const float tMax = GetHitTMax(ray, hit);
+    const float* d = ray.direction;
+    float t[8];
+    float u[8];
+    float v[8];
+    uint32_t hitMask = 0;
+    for (uint32_t lane = 0; lane < 8; ++lane) {
+        const float e1[3] = {pack.edge1[0][lane], pack.edge1[1][lane], pack.edge1[2][lane]};
+        const float e2[3] = {pack.edge2[0][lane], pack.edge2[1][lane], pack.edge2[2][lane]};
+        const float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+                            d[0] * e2[1] - d[1] * e2[0]};
+        const float determinant = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+        const float inverseDeterminant = 1.0f / determinant;
+        const float s[3] = {ray.origin[0] - pack.v0[0][lane], ray.origin[1] - pack.v0[1][lane],
+                            ray.origin[2] - pack.v0[2][lane]};
+        u[lane] = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDeterminant;
+        const float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2],
+                            s[0] * e1[1] - s[1] * e1[0]};
+        v[lane] = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverseDeterminant;
+        t[lane] = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverseDeterminant;
+        if (determinant != 0.0f && u[lane] >= 0.0f && v[lane] >= 0.0f &&
+            u[lane] + v[lane] <= 1.0f && t[lane] >= ray.tMin && t[lane] <= tMax) {
+            hitMask |= 1u << lane;
+        }
+    };
+    ResolvePackHit(pack, hitMask, t, u, v, hit);
+}
+
+static void CastRaysScalar(const CpuBvh8& bvh,
+                           const CpuRayQuery* rays,
+                           CpuRayQueryHit* outHits,
+                           uint32_t rayCount) {
+    Bvh8Stack stack;
+    for (uint32_t ii = 0; ii < rayCount; ++ii) {
+        const Bvh8RayContext ray = GetRayContext(rays[ii]);
+        CpuRayQueryHit hit;
+        stack.entries[0] = {0, ray.tMin};
+        stack.size = 1;
+        uint32_t child = 0;
+        while (PopChild(stack, GetHitTMax(ray, hit), child)) {
+            if ((child & cpuBvh8LeafBit) != 0) {
+                const CpuBvh8Leaf& leaf = bvh.leaves[child & ~cpuBvh8LeafBit];
+                for (uint32_t pack = 0; pack < leaf.packCount; ++pack) {
+                    IntersectPackScalar(bvh.packs[leaf.firstPack + pack], ray, hit);
+                };
+                continue;
+            }
+            const CpuBvh8Node& node = bvh.nodes[child];
+            float entries[8];
+            const uint32_t hitMask =
+                IntersectNodeScalar(node, ray, GetHitTMax(ray, hit), entries);
+            PushChildren(stack, node, hitMask, entries);
+        };
+        outHits[ii] = hit;
+    };
+}
+
+#ifdef CPU_RAY_CAST_X86
+CPU_RAY_CAST_SSE_TARGET static __m128 LoadQuantizedSse(const uint8_t* values) {
+    int32_t packed = 0;
+    memcpy(&packed, values, sizeof(packed));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+// two halves of 4 children each
+CPU_RAY_CAST_SSE_TARGET static uint32_t IntersectNodeSse(const CpuBvh8Node& node,
+                                                         const Bvh8RayContext& ray,
+                                                         float tMax,
+                                                         float outEntries[8]) {
+    const uint8_t* lower[3] = {node.lowerX, node.lowerY, node.lowerZ};
+    const uint8_t* upper[3] = {node.upperX, node.upperY, node.upperZ};
+    uint32_t hitMask = 0;
+    for (uint32_t half = 0; half < 8; half += 4) {
+        __m128 entry = _mm_set1_ps(ray.tMin);
+        __m128 exit = _mm_set1_ps(tMax);
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+            const __m128 a = _mm_set1_ps(node.scale[axis] * ray.inverseDirection[axis]);
+            const __m128 b = _mm_set1_ps((node.origin[axis] - ray.origin[axis]) *
+                                         ray.inverseDirection[axis]);
+            const uint8_t* nearPlanes = ray.negative[axis] ? upper[axis] : lower[axis];
+            const uint8_t* farPlanes = ray.negative[axis] ? lower[axis] : upper[axis];
+            const __m128 nearT = _mm_add_ps(_mm_mul_ps(LoadQuantizedSse(nearPlanes + half), a), b);
+            const __m128 farT = _mm_add_ps(_mm_mul_ps(LoadQuantizedSse(farPlanes + half), a), b);
+            entry = _mm_max_ps(entry, nearT);
+            exit = _mm_min_ps(exit, farT);
+        };
+        const __m128i children =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(node.children + half));
+        const __m128 empty =
+            _mm_castsi128_ps(_mm_cmpeq_epi32(children, _mm_set1_epi32(-1)));
+        const __m128 hit = _mm_andnot_ps(empty, _mm_cmple_ps(entry, exit));
+        _mm_storeu_ps(outEntries + half, entry);
+        hitMask |= (uint32_t)_mm_movemask_ps(hit) << half;
+    };
+    return hitMask;
+}
+
+CPU_RAY_CAST_SSE_TARGET static void IntersectPackSse(const CpuTrianglePack& pack,
+                                                     const Bvh8RayContext& ray,
+                                                     CpuRayQueryHit& hit) {
+    const __m128 dx = _mm_set1_ps(ray.direction[0]);
+    const __m128 dy = _mm_set1_ps(ray.direction[1]);
+    const __m128 dz = _mm_set1_ps(ray.direction[2]);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 tMin = _mm_set1_ps(ray.tMin);
+    const __m128 tMax = _mm_set1_ps(GetHitTMax(ray, hit));
+
+    float t[8];
+    float u[8];
+    float v[8];
+    uint32_t hitMask = 0;
+    for (uint32_t half = 0; half < 8; half += 4) {
+        const __m128 e1x = _mm_loadu_ps(pack.edge1[0] + half);
+        const __m128 e1y = _mm_loadu_ps(pack.edge1[1] + half);
+        const __m128 e1z = _mm_loadu_ps(pack.edge1[2] + half);
+        const __m128 e2x = _mm_loadu_ps(pack.edge2[0] + half);
+        const __m128 e2y = _mm_loadu_ps(pack.edge2[1] + half);
+        const __m128 e2z = _mm_loadu_ps(pack.edge2[2] + half);
+
+        const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        const __m128 determinant = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        const __m128 inverseDeterminant = _mm_div_ps(one, determinant);
+
+        const __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin[0]), _mm_loadu_ps(pack.v0[0] + half));
+        const __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin[1]), _mm_loadu_ps(pack.v0[1] + half));
+        const __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin[2]), _mm_loadu_ps(pack.v0[2] + half));
+        const __m128 laneU = _mm_mul_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)),
+            inverseDeterminant);
+
+        const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        const __m128 laneV = _mm_mul_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)),
+            inverseDeterminant);
+        const __m128 laneT = _mm_mul_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)),
+            inverseDeterminant);
+
+        __m128 mask = _mm_cmpneq_ps(determinant, zero);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(laneU, zero));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(laneV, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(laneU, laneV), one));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(laneT, tMin));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(laneT, tMax));
+        hitMask |= (uint32_t)_mm_movemask_ps(mask) << half;
+
+        _mm_storeu_ps(t + half, laneT);
+        _mm_storeu_ps(u + half, laneU);
+        _mm_storeu_ps(v + half, laneV);
+    };
+    ResolvePackHit(pack, hitMask, t, u, v, hit);
+}
+
+CPU_RAY_CAST_SSE_TARGET static void CastRaysSse(const CpuBvh8& bvh,
+                                                const CpuRayQuery* rays,
+                                                CpuRayQueryHit* outHits,
+                                                uint32_t rayCount) {
+    Bvh8Stack stack;
+    for (uint32_t ii = 0; ii < rayCount; ++ii) {
+        const Bvh8RayContext ray = GetRayContext(rays[ii]);
+        CpuRayQueryHit hit;
+        stack.entries[0] = {0, ray.tMin};
+        stack.size = 1;
+        uint32_t child = 0;
+        while (PopChild(stack, GetHitTMax(ray, hit), child)) {
+            if ((child & cpuBvh8LeafBit) != 0) {
+                const CpuBvh8Leaf& leaf = bvh.leaves[child & ~cpuBvh8LeafBit];
+                for (uint32_t pack = 0; pack < leaf.packCount; ++pack) {
+                    IntersectPackSse(bvh.packs[leaf.firstPack + pack], ray, hit);
+                };
+                continue;
+            }
+            const CpuBvh8Node& node = bvh.nodes[child];
+            float entries[8];
+            const uint32_t hitMask = IntersectNodeSse(node, ray, GetHitTMax(ray, hit), entries);
+            PushChildren(stack, node, hitMask, entries);
+        };
+        outHits[ii] = hit;
+    };
+}
+
+CPU_RAY_CAST_AVX2_TARGET static __m256 LoadQuantizedAvx2(const uint8_t* values) {
+    const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(values));
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+}
+
+// all 8 children at once
+CPU_RAY_CAST_AVX2_TARGET static uint32_t IntersectNodeAvx2(const CpuBvh8Node& node,
+                                                           const Bvh8RayContext& ray,
+                                                           float tMax,
+                                                           float outEntries[8]) {
+    const uint8_t* lower[3] = {node.lowerX, node.lowerY, node.lowerZ};
+    const uint8_t* upper[3] = {node.upperX, node.upperY, node.upperZ};
+    __m256 entry = _mm256_set1_ps(ray.tMin);
+    __m256 exit = _mm256_set1_ps(tMax);
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        const __m256 a = _mm256_set1_ps(node.scale[axis] * ray.inverseDirection[axis]);
+        const __m256 b = _mm256_set1_ps((node.origin[axis] - ray.origin[axis]) *
+                                        ray.inverseDirection[axis]);
+        const uint8_t* nearPlanes = ray.negative[axis] ? upper[axis] : lower[axis];
+        const uint8_t* farPlanes = ray.negative[axis] ? lower[axis] : upper[axis];
+        const __m256 nearT = _mm256_add_ps(_mm256_mul_ps(LoadQuantizedAvx2(nearPlanes), a), b);
+        const __m256 farT = _mm256_add_ps(_mm256_mul_ps(LoadQuantizedAvx2(farPlanes), a), b);
+        entry = _mm256_max_ps(entry, nearT);
+        exit = _mm256_min_ps(exit, farT);
+    };
+    const __m256i children = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(node.children));
+    const __m256 empty =
+        _mm256_castsi256_ps(_mm256_cmpeq_epi32(children, _mm256_set1_epi32(-1)));
+    const __m256 hit = _mm256_andnot_ps(empty, _mm256_cmp_ps(entry, exit, _CMP_LE_OQ));
+    _mm256_storeu_ps(outEntries, entry);
+    const uint32_t hitMask = (uint32_t)_mm256_movemask_ps(hit);
+    // the traversal around the kernels is compiled without AVX, so leave no dirty upper halves
+    // behind that would slow down its SSE instructions
+    _mm256_zeroupper();
+    return hitMask;
+}
+
+CPU_RAY_CAST_AVX2_TARGET static void IntersectPackAvx2(const CpuTrianglePack& pack,
+                                                       const Bvh8RayContext& ray,
+                                                       CpuRayQueryHit& hit) {
+    const __m256 dx = _mm256_set1_ps(ray.direction[0]);
+    const __m256 dy = _mm256_set1_ps(ray.direction[1]);
+    const __m256 dz = _mm256_set1_ps(ray.direction[2]);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    const __m256 e1x = _mm256_loadu_ps(pack.edge1[0]);
+    const __m256 e1y = _mm256_loadu_ps(pack.edge1[1]);
+    const __m256 e1z = _mm256_loadu_ps(pack.edge1[2]);
+    const __m256 e2x = _mm256_loadu_ps(pack.edge2[0]);
+    const __m256 e2y = _mm256_loadu_ps(pack.edge2[1]);
+    const __m256 e2z = _mm256_loadu_ps(pack.edge2[2]);
+
+    const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    const __m256 determinant = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    const __m256 inverseDeterminant = _mm256_div_ps(one, determinant);
+
+    const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.origin[0]), _mm256_loadu_ps(pack.v0[0]));
+    const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.origin[1]), _mm256_loadu_ps(pack.v0[1]));
+    const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.origin[2]), _mm256_loadu_ps(pack.v0[2]));
+    const __m256 laneU = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)),
+                      _mm256_mul_ps(sz, pz)),
+        inverseDeterminant);
+
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    const __m256 laneV = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)),
+                      _mm256_mul_ps(dz, qz)),
+        inverseDeterminant);
+    const __m256 laneT = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+                      _mm256_mul_ps(e2z, qz)),
+        inverseDeterminant);
+
+    __m256 mask = _mm256_cmp_ps(determinant, zero, _CMP_NEQ_UQ);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(laneU, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(laneV, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(laneU, laneV), one, _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(laneT, _mm256_set1_ps(ray.tMin), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask,
+                         _mm256_cmp_ps(laneT, _mm256_set1_ps(GetHitTMax(ray, hit)), _CMP_LE_OQ));
+    const uint32_t hitMask = (uint32_t)_mm256_movemask_ps(mask);
+    float t[8];
+    float u[8];
+    float v[8];
+    _mm256_storeu_ps(t, laneT);
+    _mm256_storeu_ps(u, laneU);
+    _mm256_storeu_ps(v, laneV);
+    _mm256_zeroupper();
+    ResolvePackHit(pack, hitMask, t, u, v, hit);
+}
+
+CPU_RAY_CAST_AVX2_TARGET static void CastRaysAvx2(const CpuBvh8& bvh,
+                                                  const CpuRayQuery* rays,
+                                                  CpuRayQueryHit* outHits,
+                                                  uint32_t rayCount) {
+    Bvh8Stack stack;
+    for (uint32_t ii = 0; ii < rayCount; ++ii) {
+        const Bvh8RayContext ray = GetRayContext(rays[ii]);
+        CpuRayQueryHit hit;
+        stack.entries[0] = {0, ray.tMin};
+        stack.size = 1;
+        uint32_t child = 0;
+        while (PopChild(stack, GetHitTMax(ray, hit), child)) {
+            if ((child & cpuBvh8LeafBit) != 0) {
+                const CpuBvh8Leaf& leaf = bvh.leaves[child & ~cpuBvh8LeafBit];
+                for (uint32_t pack = 0; pack < leaf.packCount; ++pack) {
+                    IntersectPackAvx2(bvh.packs[leaf.firstPack + pack], ray, hit);
+                };
+                continue;
+            }
+            const CpuBvh8Node& node = bvh.nodes[child];
+            float entries[8];
+            const uint32_t hitMask = IntersectNodeAvx2(node, ray, GetHitTMax(ray, hit), entries);
+            PushChildren(stack, node, hitMask, entries);
+        };
+        outHits[ii] = hit;
+    };
+}
+#endif
+
+bool IsCpuRayKernelSupported(uint32_t kernel) {
+#ifdef CPU_RAY_CAST_X86
+#    ifdef _MSC_VER
+    int info[4] = {};
+    __cpuid(info, 1);
+    const bool hasSse2 = (info[3] & (1 << 26)) != 0;
+    // AVX registers also have to be saved by the OS
+    bool hasAvx2 = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 &&
+                   (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    hasAvx2 = hasAvx2 && (info[1] & (1 << 5)) != 0;
+#    else
+    const bool hasSse2 = __builtin_cpu_supports("sse2");
+    const bool hasAvx2 = __builtin_cpu_supports("avx2");
+#    endif
+    switch (kernel) {
+        case cpuRayKernelScalar:
+            return true;
+        case cpuRayKernelSse:
+            return hasSse2;
+        case cpuRayKernelAvx2:
+            return hasAvx2;
+        default:
+            return false;
+    }
+#else
+    return kernel == cpuRayKernelScalar;
+#endif
+}
+
+uint32_t GetBestCpuRayKernel() {
+    for (uint32_t kernel = cpuRayKernelCount - 1; kernel > cpuRayKernelScalar; --kernel) {
+        if (IsCpuRayKernelSupported(kernel)) {
+            return kernel;
+        }
+    };
+    return cpuRayKernelScalar;
+}
+
+const char* GetCpuRayKernelName(uint32_t kernel) {
+    switch (kernel) {
+        case cpuRayKernelSse:
+            return "SSE";
+        case cpuRayKernelAvx2:
+            return "AVX2";
+        default:
+            return "scalar";
+    }
+}
+
+void CastCpuRays(const CpuBvh8& bvh,
+                 const CpuRayQuery* rays,
+                 CpuRayQueryHit* outHits,
+                 uint32_t rayCount,
+                 uint32_t kernel) {
+#ifdef CPU_RAY_CAST_X86
+    if (kernel == cpuRayKernelAvx2 && IsCpuRayKernelSupported(kernel)) {
+        CastRaysAvx2(bvh, rays, outHits, rayCount);
+        return;
+    }
+    if (kernel == cpuRayKernelSse && IsCpuRayKernelSupported(kernel)) {
+        CastRaysSse(bvh, rays, outHits, rayCount);
+        return;
+    }
+#endif
+    CastRaysScalar(bvh, rays, outHits, rayCount);
+}
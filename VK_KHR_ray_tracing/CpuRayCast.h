@@ -0,0 +1,90 @@
+#pragma once
+
+#include "CpuRenderer.h"
+
+#include <cstdint>
+#include <vector>
+
+// ray-box and triangle kernels CastCpuRays can run, wider ones are only used when compiled for
+// and supported by the CPU. AVX-512 machines run the AVX2 kernel, it already covers all 8
+// children of a node in one register
+const uint32_t cpuRayKernelScalar = 0;
+const uint32_t cpuRayKernelSse = 1;
+const uint32_t cpuRayKernelAvx2 = 2;
+const uint32_t cpuRayKernelCount = 3;
+
+// children of a node that are leaves have this bit set and index CpuBvh8.leaves
+const uint32_t cpuBvh8LeafBit = 0x80000000u;
+const uint32_t cpuBvh8EmptyChild = 0xFFFFFFFFu;
+const uint32_t cpuRayMiss = 0xFFFFFFFFu;
+
+// 8-wide node with child bounds quantized to 8 bits per plane relative to the node's bounds,
+// 104 bytes instead of the 224 the plain float bounds would take
+struct CpuBvh8Node {
+    float origin[3] = {};
+    // power of two step of the quantization grid per axis
+    float scale[3] = {};
+    // child ii spans origin + lower[ii] * scale .. origin + upper[ii] * scale
+    uint8_t lowerX[8] = {};
+    uint8_t upperX[8] = {};
+    uint8_t lowerY[8] = {};
+    uint8_t upperY[8] = {};
+    uint8_t lowerZ[8] = {};
+    uint8_t upperZ[8] = {};
+    uint32_t children[8] = {};
+};
+
+// 8 triangles as structure of arrays, unused lanes are degenerate and never hit
+struct CpuTrianglePack {
+    float v0[3][8] = {};
+    float edge1[3][8] = {};
+    float edge2[3][8] = {};
+    uint32_t primitiveIndices[8] = {};
+};
+
+struct CpuBvh8Leaf {
+    uint32_t firstPack = 0;
+    uint32_t packCount = 0;
+};
+
+// node 0 is the root
+struct CpuBvh8 {
+    std::vector<CpuBvh8Node> nodes;
+    std::vector<CpuBvh8Leaf> leaves;
+    std::vector<CpuTrianglePack> packs;
+};
+
+struct CpuRayQuery {
+    float origin[3] = {};
+    float direction[3] = {};
+    float tMin = 0.0f;
+    float tMax = 0.0f;
+};
+
+// primitiveIndex is cpuRayMiss or the index CpuBvh.primitiveIndices gives the hit triangle, u and
+// v weight its second and third vertex like the hit attributes of the closest hit shader
+struct CpuRayQueryHit {
+    float t = 0.0f;
+    float u = 0.0f;
+    float v = 0.0f;
+    uint32_t primitiveIndex = cpuRayMiss;
+};
+
+// collapses the binary BVH into one with up to 8 children per node, always picking the child with
+// the largest surface area to open next
+void BuildCpuBvh8(const CpuBvh& bvh, CpuBvh8& out);
+
+bool IsCpuRayKernelSupported(uint32_t kernel);
+
+// the widest kernel the CPU supports
+uint32_t GetBestCpuRayKernel();
+
+const char* GetCpuRayKernelName(uint32_t kernel);
+
+// finds the closest hit of every ray, meant for batches of thousands of rays like picking,
+// visibility or collision probes. falls back to the scalar kernel if the given one is unsupported
+void CastCpuRays(const CpuBvh8& bvh,
+                 const CpuRayQuery* rays,
+                 CpuRayQueryHit* outHits,
+                 uint32_t rayCount,
+                 uint32_t kernel);
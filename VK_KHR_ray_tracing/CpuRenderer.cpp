@@ -0,0 +1,516 @@
+#include "CpuRenderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <mutex>
+
+// centroids are sorted into this many bins per axis when searching for a split
+const uint32_t cpuBinCount = 16;
+// leaves are split further whenever SAH thinks that pays off, and while they hold more than this
+const uint32_t cpuMaxLeafSize = 8;
+// relative to intersecting a single triangle
+const float cpuTraversalCost = 1.0f;
+const uint32_t cpuTileSize = 16;
+// traversal pushes at most one node per level, deeper nodes become leaves no matter their size
+const uint32_t cpuMaxDepth = 64;
+
+struct Bounds {
+    float min[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                    std::numeric_limits<float>::max()};
+    float max[3] = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+                    -std::numeric_limits<float>::max()};
+};
+
+static void GrowBounds(Bounds& bounds, const float point[3]) {
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        bounds.min[axis] = std::min(bounds.min[axis], point[axis]);
+        bounds.max[axis] = std::max(bounds.max[axis], point[axis]);
+    };
+}
+
+static void GrowBounds(Bounds& bounds, const Bounds& other) {
+    GrowBounds(bounds, other.min);
+    GrowBounds(bounds, other.max);
+}
+
+// half the surface area, only ever compared against other areas
+static float GetHalfArea(const Bounds& bounds) {
+    const float x = std::max(0.0f, bounds.max[0] - bounds.min[0]);
+    const float y = std::max(0.0f, bounds.max[1] - bounds.min[1]);
+    const float z = std::max(0.0f, bounds.max[2] - bounds.min[2]);
+    return x * y + y * z + z * x;
+}
+
+struct BuildPrimitive {
+    Bounds bounds;
+    float centroid[3] = {};
+};
+
+// a node whose primitives [first, first + count) of the index array still have to be split
+struct BuildTask {
+    uint32_t nodeIndex = 0;
+    uint32_t first = 0;
+    uint32_t count = 0;
+    uint32_t depth = 0;
+};
+
+struct BuildBin {
+    Bounds bounds;
+    uint32_t count = 0;
+};
+
+struct SplitCandidate {
+    uint32_t axis = 0;
+    uint32_t bin = 0;
+    float cost = std::numeric_limits<float>::max();
+};
+
+static uint32_t GetBinIndex(float centroid, float centroidMin, float binScale) {
+    return std::min(cpuBinCount - 1, (uint32_t)((centroid - centroidMin) * binScale));
+}
+
+// finds the cheapest bin boundary on all axes, the cost is relative to the parent's area
+static SplitCandidate FindBinnedSplit(const std::vector<BuildPrimitive>& primitives,
+                                      const uint32_t* indices,
+                                      uint32_t count,
+                                      const Bounds& centroidBounds,
+                                      float parentArea) {
+    SplitCandidate best;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        if (extent <= 0.0f) {
+            continue;
+        }
+        const float binScale = (float)cpuBinCount / extent;
+
+        BuildBin bins[cpuBinCount];
+        for (uint32_t ii = 0; ii < count; ++ii) {
+            const BuildPrimitive& primitive = primitives[indices[ii]];
+            BuildBin& bin =
+                bins[GetBinIndex(primitive.centroid[axis], centroidBounds.min[axis], binScale)];
+            GrowBounds(bin.bounds, primitive.bounds);
+            ++bin.count;
+        };
+
+        // sweep from the right first so the left sweep can evaluate every boundary directly
+        float rightAreas[cpuBinCount] = {};
+        uint32_t rightCounts[cpuBinCount] = {};
+        Bounds rightBounds;
+        uint32_t rightCount = 0;
+        for (uint32_t bin = cpuBinCount - 1; bin > 0; --bin) {
+            GrowBounds(rightBounds, bins[bin].bounds);
+            rightCount += bins[bin].count;
+            rightAreas[bin] = GetHalfArea(rightBounds);
+            rightCounts[bin] = rightCount;
+        };
+
+        Bounds leftBounds;
+        uint32_t leftCount = 0;
+        for (uint32_t bin = 1; bin < cpuBinCount; ++bin) {
+            GrowBounds(leftBounds, bins[bin - 1].bounds);
+            leftCount += bins[bin - 1].count;
+            if (leftCount == 0 || rightCounts[bin] == 0) {
+                continue;
+            }
+            const float cost =
+                cpuTraversalCost + (GetHalfArea(leftBounds) * leftCount +
+                                    rightAreas[bin] * rightCounts[bin]) /
+                                       parentArea;
+            if (cost < best.cost) {
+                best.axis = axis;
+                best.bin = bin;
+                best.cost = cost;
+            }
+        };
+    };
+    return best;
+}
+
+void BuildCpuBvh(const Scene& scene, CpuBvh& out) {
+    out = {};
+
+    // instances are flattened, barycentrics don't change under their affine transforms
+    std::vector<BuildPrimitive> primitives;
+    std::vector<CpuTriangle> triangles;
+    for (const SceneInstance& instance : scene.instances) {
+        const SceneMesh& mesh = scene.meshes[instance.meshIndex];
+        for (uint32_t ii = 0; ii + 2 < mesh.indexCount; ii += 3) {
+            float vertices[3][3];
+            for (uint32_t corner = 0; corner < 3; ++corner) {
+                const uint32_t index = scene.indices[mesh.firstIndex + ii + corner];
+                const float* p = scene.positions + 3 * (size_t)(mesh.firstVertex + index);
+                for (uint32_t row = 0; row < 3; ++row) {
+                    const float* t = instance.transform[row];
+                    vertices[corner][row] = t[0] * p[0] + t[1] * p[1] + t[2] * p[2] + t[3];
+                };
+            };
+
+            CpuTriangle triangle;
+            BuildPrimitive primitive;
+            for (uint32_t axis = 0; axis < 3; ++axis) {
+                triangle.v0[axis] = vertices[0][axis];
+                triangle.edge1[axis] = vertices[1][axis] - vertices[0][axis];
+                triangle.edge2[axis] = vertices[2][axis] - vertices[0][axis];
+            };
+            for (uint32_t corner = 0; corner < 3; ++corner) {
+                GrowBounds(primitive.bounds, vertices[corner]);
+            };
+            for (uint32_t axis = 0; axis < 3; ++axis) {
+                primitive.centroid[axis] =
+                    0.5f * (primitive.bounds.min[axis] + primitive.bounds.max[axis]);
+            };
+            triangles.push_back(triangle);
+            primitives.push_back(primitive);
+        };
+    };
+
+    const uint32_t primitiveCount = (uint32_t)primitives.size();
+    std::vector<uint32_t> indices(primitiveCount);
+    for (uint32_t ii = 0; ii < primitiveCount; ++ii) {
+        indices[ii] = ii;
+    };
+
+    out.nodes.reserve(std::max(1u, 2 * primitiveCount));
+    out.nodes.emplace_back();
+    std::vector<BuildTask> tasks;
+    tasks.push_back({0, 0, primitiveCount, 0});
+    while (!tasks.empty()) {
+        const BuildTask task = tasks.back();
+        tasks.pop_back();
+        uint32_t* taskIndices = indices.data() + task.first;
+
+        Bounds bounds;
+        Bounds centroidBounds;
+        for (uint32_t ii = 0; ii < task.count; ++ii) {
+            const BuildPrimitive& primitive = primitives[taskIndices[ii]];
+            GrowBounds(bounds, primitive.bounds);
+            GrowBounds(centroidBounds, primitive.centroid);
+        };
+
+        CpuBvhNode& node = out.nodes[task.nodeIndex];
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+            node.boundsMin[axis] = bounds.min[axis];
+            node.boundsMax[axis] = bounds.max[axis];
+        };
+        node.firstChildOrPrimitive = task.first;
+        node.primitiveCount = task.count;
+        if (task.count <= 1 || task.depth >= cpuMaxDepth) {
+            continue;
+        }
+
+        const float area = GetHalfArea(bounds);
+        const SplitCandidate split =
+            area > 0.0f ? FindBinnedSplit(primitives, taskIndices, task.count, centroidBounds, area)
+                        : SplitCandidate();
+        const bool hasSplit = split.cost < std::numeric_limits<float>::max();
+        if (task.count <= cpuMaxLeafSize && (!hasSplit || split.cost >= (float)task.count)) {
+            continue;
+        }
+
+        // primitives with the same centroid or on a flat node are simply halved
+        uint32_t leftCount = task.count / 2;
+        if (hasSplit) {
+            const float binScale =
+                (float)cpuBinCount /
+                (centroidBounds.max[split.axis] - centroidBounds.min[split.axis]);
+            uint32_t* middle =
+                std::partition(taskIndices, taskIndices + task.count, [&](uint32_t index) {
+                    return GetBinIndex(primitives[index].centroid[split.axis],
+                                       centroidBounds.min[split.axis], binScale) < split.bin;
+                });
+            leftCount = (uint32_t)(middle - taskIndices);
+        }
+
+        const uint32_t childIndex = (uint32_t)out.nodes.size();
+        node.firstChildOrPrimitive = childIndex;
+        node.primitiveCount = 0;
+        out.nodes.emplace_back();
+        out.nodes.emplace_back();
+        tasks.push_back({childIndex, task.first, leftCount, task.depth + 1});
+        tasks.push_back(
+            {childIndex + 1, task.first + leftCount, task.count - leftCount, task.depth + 1});
+    };
+
+    out.triangles.resize(primitiveCount);
+    for (uint32_t ii = 0; ii < primitiveCount; ++ii) {
+        out.triangles[ii] = triangles[indices[ii]];
+    };
+    out.primitiveIndices = indices;
+}
+
+struct CpuRay {
+    float origin[3] = {};
+    float direction[3] = {};
+    float inverseDirection[3] = {};
+    float tMin = 0.0f;
+    float tMax = 0.0f;
+};
+
+// what the closest hit shader gets as hit attributes
+struct CpuHit {
+    float t = 0.0f;
+    float u = 0.0f;
+    float v = 0.0f;
+    bool hit = false;
+};
+
+// returns the distance the ray enters the node at, or infinity when it misses before tMax
+static float IntersectNode(const CpuBvhNode& node, const CpuRay& ray, float tMax) {
+    float entry = ray.tMin;
+    float exit = tMax;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        const float t0 = (node.boundsMin[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+        const float t1 = (node.boundsMax[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+        entry = std::max(entry, std::min(t0, t1));
+        exit = std::min(exit, std::max(t0, t1));
+    };
+    return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+}
+
+// Moller-Trumbore without culling, like an opaque hit with culling disabled on the instance
+static void IntersectTriangle(const CpuTriangle& triangle, const CpuRay& ray, CpuHit& hit) {
+    const float* d = ray.direction;
+    const float* e1 = triangle.edge1;
+    const float* e2 = triangle.edge2;
+    const float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+                        d[0] * e2[1] - d[1] * e2[0]};
+    const float determinant = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if (determinant == 0.0f) {
+        return;
+    }
+    const float inverseDeterminant = 1.0f / determinant;
+
+    const float s[3] = {ray.origin[0] - triangle.v0[0], ray.origin[1] - triangle.v0[1],
+                        ray.origin[2] - triangle.v0[2]};
+    const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f) {
+        return;
+    }
+
+    const float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2],
+                        s[0] * e1[1] - s[1] * e1[0]};
+    const float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f) {
+        return;
+    }
+
+    const float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverseDeterminant;
+    if (t < ray.tMin || t > (hit.hit ? hit.t : ray.tMax)) {
+        return;
+    }
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    hit.hit = true;
+}
+
+// a node the ray enters at entry, skipped if a closer hit was found since it was pushed
+struct TraversalEntry {
+    uint32_t nodeIndex = 0;
+    float entry = 0.0f;
+};
+
+static CpuHit TraceCpuRay(const CpuBvh& bvh, const CpuRay& ray) {
+    CpuHit hit;
+    if (bvh.triangles.empty()) {
+        return hit;
+    }
+
+    TraversalEntry stack[cpuMaxDepth + 1];
+    uint32_t stackSize = 0;
+    const float rootEntry = IntersectNode(bvh.nodes[0], ray, ray.tMax);
+    if (rootEntry <= ray.tMax) {
+        stack[stackSize++] = {0, rootEntry};
+    }
+    while (stackSize > 0) {
+        const TraversalEntry current = stack[--stackSize];
+        const float tMax = hit.hit ? hit.t : ray.tMax;
+        if (current.entry > tMax) {
+            continue;
+        }
+
+        const CpuBvhNode& node = bvh.nodes[current.nodeIndex];
+        if (node.primitiveCount > 0) {
+            for (uint32_t ii = 0; ii < node.primitiveCount; ++ii) {
+                IntersectTriangle(bvh.triangles[node.firstChildOrPrimitive + ii], ray, hit);
+            };
+            continue;
+        }
+
+        // the nearer child is pushed last so it is visited first
+        const uint32_t left = node.firstChildOrPrimitive;
+        TraversalEntry near = {left, IntersectNode(bvh.nodes[left], ray, tMax)};
+        TraversalEntry far = {left + 1, IntersectNode(bvh.nodes[left + 1], ray, tMax)};
+        if (far.entry < near.entry) {
+            std::swap(near, far);
+        }
+        if (far.entry <= tMax) {
+            stack[stackSize++] = far;
+        }
+        if (near.entry <= tMax) {
+            stack[stackSize++] = near;
+        }
+    };
+    return hit;
+}
+
+// ray-generation.rgen followed by ray-closest-hit.rchit or ray-miss.rmiss
+static void ShadeCpuPixel(const CpuBvh& bvh,
+                          uint32_t x,
+                          uint32_t y,
+                          uint32_t width,
+                          uint32_t height,
+                          float* outPixel) {
+    const float d[2] = {((float)x + 0.5f) / (float)width * 2.0f - 1.0f,
+                        ((float)y + 0.5f) / (float)height * 2.0f - 1.0f};
+    const float aspect = (float)width / (float)height;
+
+    CpuRay ray;
+    ray.origin[2] = -1.5f;
+    ray.direction[0] = d[0] * aspect;
+    ray.direction[1] = d[1];
+    ray.direction[2] = 1.0f;
+    const float length =
+        std::sqrt(ray.direction[0] * ray.direction[0] + ray.direction[1] * ray.direction[1] +
+                  ray.direction[2] * ray.direction[2]);
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        ray.direction[axis] /= length;
+        ray.inverseDirection[axis] = 1.0f / ray.direction[axis];
+    };
+    ray.tMin = 0.001f;
+    ray.tMax = 100.0f;
+
+    const CpuHit hit = TraceCpuRay(bvh, ray);
+    if (hit.hit) {
+        outPixel[0] = 1.0f - hit.u - hit.v;
+        outPixel[1] = hit.u;
+        outPixel[2] = hit.v;
+    } else {
+        outPixel[0] = 0.3f;
+        outPixel[1] = 0.3f;
+        outPixel[2] = 0.3f;
+    }
+    outPixel[3] = 1.0f;
+}
+
+// tiles [begin, end) one thread still has to render, the owner takes them from the front and
+// thieves take the back half
+struct TileQueue {
+    std::mutex mutex;
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+static bool PopTile(TileQueue& queue, uint32_t& outTile) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.begin == queue.end) {
+        return false;
+    }
+    outTile = queue.begin++;
+    return true;
+}
+
+// moves half of the first non-empty queue into the thief's empty one, fails once all are empty.
+// stolen tiles are in no queue for a moment, but the thief renders them either way
+static bool StealTiles(std::vector<TileQueue>& queues,
+                       uint32_t thief,
+                       std::atomic<uint32_t>& stolenTileCount) {
+    const uint32_t queueCount = (uint32_t)queues.size();
+    for (uint32_t offset = 1; offset < queueCount; ++offset) {
+        TileQueue& victim = queues[(thief + offset) % queueCount];
+        uint32_t begin = 0;
+        uint32_t end = 0;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            const uint32_t remaining = victim.end - victim.begin;
+            if (remaining == 0) {
+                continue;
+            }
+            end = victim.end;
+            begin = end - (remaining + 1) / 2;
+            victim.end = begin;
+        }
+
+        TileQueue& own = queues[thief];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.begin = begin;
+        own.end = end;
+        stolenTileCount += end - begin;
+        return true;
+    };
+    return false;
+}
+
+void RenderCpuImage(ThreadPool& pool,
+                    uint32_t threadCount,
+                    const CpuBvh& bvh,
+                    CpuImage& image,
+                    CpuRenderStats& stats) {
+    image.pixels.resize((size_t)image.width * image.height * 4);
+
+    const uint32_t tilesX = (image.width + cpuTileSize - 1) / cpuTileSize;
+    const uint32_t tilesY = (image.height + cpuTileSize - 1) / cpuTileSize;
+    const uint32_t tileCount = tilesX * tilesY;
+    threadCount = std::max(1u, std::min(threadCount, tileCount));
+
+    std::vector<TileQueue> queues(threadCount);
+    for (uint32_t ii = 0; ii < threadCount; ++ii) {
+        queues[ii].begin = (uint32_t)((uint64_t)tileCount * ii / threadCount);
+        queues[ii].end = (uint32_t)((uint64_t)tileCount * (ii + 1) / threadCount);
+    };
+    std::atomic<uint32_t> stolenTileCount(0);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    RunParallel(pool, threadCount, [&](uint32_t taskIndex, uint32_t) {
+        while (true) {
+            uint32_t tile = 0;
+            if (!PopTile(queues[taskIndex], tile)) {
+                if (!StealTiles(queues, taskIndex, stolenTileCount)) {
+                    return;
+                }
+                continue;
+            }
+
+            const uint32_t x0 = tile % tilesX * cpuTileSize;
+            const uint32_t y0 = tile / tilesX * cpuTileSize;
+            const uint32_t x1 = std::min(x0 + cpuTileSize, image.width);
+            const uint32_t y1 = std::min(y0 + cpuTileSize, image.height);
+            for (uint32_t y = y0; y < y1; ++y) {
+                for (uint32_t x = x0; x < x1; ++x) {
+                    float* pixel = &image.pixels[((size_t)y * image.width + x) * 4];
+                    ShadeCpuPixel(bvh, x, y, image.width, image.height, pixel);
+                };
+            };
+        };
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+
+    stats.rayCount = (uint64_t)image.width * image.height;
+    stats.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    stats.stolenTileCount = stolenTileCount;
+}
+
+bool WriteCpuImage(const std::string& path, const CpuImage& image) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    file << "P6\n" << image.width << " " << image.height << "\n255\n";
+
+    std::vector<uint8_t> row(image.width * 3);
+    for (uint32_t y = 0; y < image.height; ++y) {
+        for (uint32_t x = 0; x < image.width; ++x) {
+            for (uint32_t channel = 0; channel < 3; ++channel) {
+                const float value = image.pixels[((size_t)y * image.width + x) * 4 + channel];
+                row[x * 3 + channel] =
+                    (uint8_t)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+            };
+        };
+        file.write(reinterpret_cast<const char*>(row.data()), row.size());
+    };
+    return (bool)file;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "SceneLoader.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// world space triangle, stored as its first vertex and the two edges leaving it
+struct CpuTriangle {
+    float v0[3] = {};
+    float edge1[3] = {};
+    float edge2[3] = {};
+};
+
+// inner nodes have no primitives and their children at firstChildOrPrimitive and the one after,
+// leaves reference primitiveCount triangles starting at firstChildOrPrimitive
+struct CpuBvhNode {
+    float boundsMin[3] = {};
+    float boundsMax[3] = {};
+    uint32_t firstChildOrPrimitive = 0;
+    uint32_t primitiveCount = 0;
+};
+
+// binary BVH over every instance of a scene flattened into world space, node 0 is the root
+struct CpuBvh {
+    std::vector<CpuBvhNode> nodes;
+    std::vector<CpuTriangle> triangles;
+    // position of each triangle when counting the triangles of all instances in scene order
+    std::vector<uint32_t> primitiveIndices;
+};
+
+// rgba32f pixels, row by row from the top, unlike the 8 bit offscreen buffer of the GPU path
+struct CpuImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<float> pixels;
+};
+
+struct CpuRenderStats {
+    uint64_t rayCount = 0;
+    double milliseconds = 0.0;
+    // tiles that were taken from another thread's queue
+    uint32_t stolenTileCount = 0;
+};
+
+// builds the BVH with binned SAH splits over the same positions and indices the BLAS get
+void BuildCpuBvh(const Scene& scene, CpuBvh& out);
+
+// renders what the ray generation, closest hit and miss shaders render, tiles are dealt out
+// evenly to threadCount tasks of the pool and threads that run dry steal from the others
+void RenderCpuImage(ThreadPool& pool,
+                    uint32_t threadCount,
+                    const CpuBvh& bvh,
+                    CpuImage& image,
+                    CpuRenderStats& stats);
+
+// writes the image as a binary .ppm, clamped to [0, 1]
+bool WriteCpuImage(const std::string& path, const CpuImage& image);
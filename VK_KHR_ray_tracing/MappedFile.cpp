@@ -0,0 +1,113 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#    include <Windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include <iostream>
+
+bool OpenMappedFile(const std::string& path, MappedFile& out) {
+    out = {};
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        std::cout << "Could not open " << path << std::endl;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize = {};
+    GetFileSizeEx(fileHandle, &fileSize);
+    out.fileHandle = fileHandle;
+    out.size = (size_t)fileSize.QuadPart;
+
+    // empty files can't be mapped, but are still valid
+    if (out.size == 0) {
+        return true;
+    }
+
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr) {
+        std::cout << "Could not map " << path << std::endl;
+        CloseMappedFile(out);
+        return false;
+    }
+    out.mappingHandle = mappingHandle;
+    out.data = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+    int fileDescriptor = open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0) {
+        std::cout << "Could not open " << path << std::endl;
+        return false;
+    }
+
+    struct stat fileStat = {};
+    fstat(fileDescriptor, &fileStat);
+    out.fileDescriptor = fileDescriptor;
+    out.size = (size_t)fileStat.st_size;
+
+    if (out.size == 0) {
+        return true;
+    }
+
+    void* data = mmap(nullptr, out.size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (data != MAP_FAILED) {
+        // all of it is parsed right away, so start reading ahead on every page
+        madvise(data, out.size, MADV_WILLNEED);
+        out.data = static_cast<const uint8_t*>(data);
+    }
+#endif
+    if (out.data == nullptr) {
+        std::cout << "Could not map " << path << std::endl;
+        CloseMappedFile(out);
+        return false;
+    }
+    return true;
+}
+
+void CloseMappedFile(MappedFile& file) {
+#ifdef _WIN32
+    if (file.data != nullptr) {
+        UnmapViewOfFile(file.data);
+    }
+    if (file.mappingHandle != nullptr) {
+        CloseHandle(file.mappingHandle);
+    }
+    if (file.fileHandle != nullptr) {
+        CloseHandle(file.fileHandle);
+    }
+#else
+    if (file.data != nullptr) {
+        munmap(const_cast<uint8_t*>(file.data), file.size);
+    }
+    if (file.fileDescriptor >= 0) {
+        close(file.fileDescriptor);
+    }
+#endif
+    file = {};
+}
+
+bool GetFileInfo(const std::string& path, uint64_t& size, int64_t& modifiedTime) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attributes = {};
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes)) {
+        return false;
+    }
+    size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    modifiedTime = ((int64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) |
+                   attributes.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat fileStat = {};
+    if (stat(path.c_str(), &fileStat) != 0) {
+        return false;
+    }
+    size = (uint64_t)fileStat.st_size;
+    modifiedTime = (int64_t)fileStat.st_mtime;
+#endif
+    return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// read-only view of a whole file, backed by the OS page cache instead of a heap copy
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+};
+
+bool OpenMappedFile(const std::string& path, MappedFile& out);
+
+void CloseMappedFile(MappedFile& file);
+
+// size and last modification time without opening the file, false if it does not exist
+bool GetFileInfo(const std::string& path, uint64_t& size, int64_t& modifiedTime);
@@ -0,0 +1,1201 @@
+#include "SceneLoader.h"
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// text is split into chunks of roughly this size, each parsed by one task
+const size_t objChunkSize = 1024 * 1024;
+// binary copies are split into tasks of this many elements
+const uint32_t gltfCopyBatchSize = 64 * 1024;
+
+const uint32_t jsonNone = 0xFFFFFFFF;
+
+static bool IsSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static bool IsLineEnd(char c) {
+    return c == '\n' || c == '\r';
+}
+
+static bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char* SkipSpaces(const char* p, const char* end) {
+    while (p < end && IsSpace(*p)) {
+        ++p;
+    };
+    return p;
+}
+
+static const char* NextLine(const char* p, const char* end) {
+    while (p < end && *p != '\n') {
+        ++p;
+    };
+    return p < end ? p + 1 : end;
+}
+
+// locale independent and much faster than strtod, exact for integers up to 2^53 so JSON byte
+// offsets and counts survive
+static bool ParseDouble(const char*& p, const char* end, double& out) {
+    static const double powersOfTen[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                         1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                         1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    p = SkipSpaces(p, end);
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int32_t exponent = 0;
+    bool hasDigits = false;
+    for (; p < end && IsDigit(*p); ++p) {
+        // digits beyond what fits into the mantissa only scale the value
+        if (mantissa < 1000000000000000000ull) {
+            mantissa = mantissa * 10 + (*p - '0');
+        } else {
+            ++exponent;
+        }
+        hasDigits = true;
+    };
+    if (p < end && *p == '.') {
+        for (++p; p < end && IsDigit(*p); ++p) {
+            if (mantissa < 1000000000000000000ull) {
+                mantissa = mantissa * 10 + (*p - '0');
+                --exponent;
+            }
+            hasDigits = true;
+        };
+    }
+    if (hasDigits && p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        int32_t value = 0;
+        for (; p < end && IsDigit(*p); ++p) {
+            value = std::min(value * 10 + (*p - '0'), 1000);
+        };
+        exponent += negativeExponent ? -value : value;
+    }
+
+    double result = (double)mantissa;
+    if (exponent < 0) {
+        result = -exponent <= 22 ? result / powersOfTen[-exponent]
+                                 : result * std::pow(10.0, exponent);
+    } else if (exponent > 0) {
+        result = exponent <= 22 ? result * powersOfTen[exponent]
+                                : result * std::pow(10.0, exponent);
+    }
+    out = negative ? -result : result;
+    return hasDigits;
+}
+
+static bool ParseFloat(const char*& p, const char* end, float& out) {
+    double value = 0.0;
+    const bool parsed = ParseDouble(p, end, value);
+    out = (float)value;
+    return parsed;
+}
+
+static bool ParseInt(const char*& p, const char* end, int64_t& out) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    int64_t value = 0;
+    bool hasDigits = false;
+    for (; p < end && IsDigit(*p); ++p) {
+        value = value * 10 + (*p - '0');
+        hasDigits = true;
+    };
+    out = negative ? -value : value;
+    return hasDigits;
+}
+
+// a line-aligned piece of an OBJ file together with where its output goes
+struct ObjChunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    uint32_t vertexCount = 0;
+    uint32_t triangleCount = 0;
+    uint32_t firstVertex = 0;
+    uint32_t firstTriangle = 0;
+    bool failed = false;
+};
+
+static bool IsObjStatement(const char* p, const char* end, char type) {
+    return p + 1 < end && p[0] == type && IsSpace(p[1]);
+}
+
+// first pass, only counts so every chunk knows where to write in the second pass
+static void CountObjChunk(ObjChunk& chunk) {
+    const char* end = chunk.end;
+    for (const char* p = chunk.begin; p < end; p = NextLine(p, end)) {
+        p = SkipSpaces(p, end);
+        if (IsObjStatement(p, end, 'v')) {
+            ++chunk.vertexCount;
+        } else if (IsObjStatement(p, end, 'f')) {
+            uint32_t cornerCount = 0;
+            p += 1;
+            while (true) {
+                p = SkipSpaces(p, end);
+                if (p == end || IsLineEnd(*p) || *p == '#') {
+                    break;
+                }
+                ++cornerCount;
+                while (p < end && !IsSpace(*p) && !IsLineEnd(*p)) {
+                    ++p;
+                };
+            };
+            if (cornerCount >= 3) {
+                chunk.triangleCount += cornerCount - 2;
+            }
+        }
+    };
+}
+
+// second pass, writes positions and fan-triangulated faces straight into the scene arrays
+static void ParseObjChunk(ObjChunk& chunk, uint32_t totalVertexCount, Scene& scene) {
+    const char* end = chunk.end;
+    float* positions = scene.positionStorage.data() + (size_t)chunk.firstVertex * 3;
+    uint32_t* indices = scene.indexStorage.data() + (size_t)chunk.firstTriangle * 3;
+    uint32_t vertexCount = 0;
+
+    for (const char* p = chunk.begin; p < end; p = NextLine(p, end)) {
+        p = SkipSpaces(p, end);
+        if (IsObjStatement(p, end, 'v')) {
+            p += 1;
+            float* position = positions + (size_t)vertexCount * 3;
+            if (!ParseFloat(p, end, position[0]) || !ParseFloat(p, end, position[1]) ||
+                !ParseFloat(p, end, position[2])) {
+                chunk.failed = true;
+            }
+            ++vertexCount;
+        } else if (IsObjStatement(p, end, 'f')) {
+            p += 1;
+            uint32_t corners[3] = {};
+            uint32_t cornerCount = 0;
+            while (true) {
+                p = SkipSpaces(p, end);
+                if (p == end || IsLineEnd(*p) || *p == '#') {
+                    break;
+                }
+                // only the position index of v, v/vt, v//vn or v/vt/vn is used
+                int64_t index = 0;
+                if (!ParseInt(p, end, index) || index == 0) {
+                    chunk.failed = true;
+                }
+                while (p < end && !IsSpace(*p) && !IsLineEnd(*p)) {
+                    ++p;
+                };
+                // negative indices count back from the last vertex defined before the face
+                int64_t resolved = index > 0 ? index - 1 : chunk.firstVertex + vertexCount + index;
+                if (resolved < 0 || resolved >= totalVertexCount) {
+                    chunk.failed = true;
+                    resolved = 0;
+                }
+
+                if (cornerCount < 2) {
+                    corners[cornerCount] = (uint32_t)resolved;
+                } else {
+                    corners[2] = (uint32_t)resolved;
+                    indices[0] = corners[0];
+                    indices[1] = corners[1];
+                    indices[2] = corners[2];
+                    indices += 3;
+                    corners[1] = corners[2];
+                }
+                ++cornerCount;
+            };
+        }
+    };
+}
+
+// all faces of the file end up in a single mesh with one instance
+static bool LoadObj(ThreadPool& pool, const MappedFile& file, Scene& out) {
+    const char* text = reinterpret_cast<const char*>(file.data);
+    const char* textEnd = text + file.size;
+
+    // split at line boundaries so no statement spans two chunks
+    std::vector<ObjChunk> chunks;
+    const char* chunkBegin = text;
+    while (chunkBegin < textEnd) {
+        ObjChunk chunk = {};
+        chunk.begin = chunkBegin;
+        chunk.end = textEnd;
+        if ((size_t)(textEnd - chunkBegin) > objChunkSize) {
+            chunk.end = NextLine(chunkBegin + objChunkSize, textEnd);
+        }
+        chunks.push_back(chunk);
+        chunkBegin = chunk.end;
+    };
+
+    RunParallel(pool, (uint32_t)chunks.size(),
+                [&](uint32_t index, uint32_t) { CountObjChunk(chunks[index]); });
+
+    uint64_t vertexCount = 0;
+    uint64_t triangleCount = 0;
+    for (ObjChunk& chunk : chunks) {
+        chunk.firstVertex = (uint32_t)vertexCount;
+        chunk.firstTriangle = (uint32_t)triangleCount;
+        vertexCount += chunk.vertexCount;
+        triangleCount += chunk.triangleCount;
+    };
+    if (vertexCount > UINT32_MAX || triangleCount * 3 > UINT32_MAX) {
+        std::cout << "OBJ file exceeds 32-bit vertex or index counts" << std::endl;
+        return false;
+    }
+
+    out.positionStorage.resize((size_t)vertexCount * 3);
+    out.indexStorage.resize((size_t)triangleCount * 3);
+
+    RunParallel(pool, (uint32_t)chunks.size(), [&](uint32_t index, uint32_t) {
+        ParseObjChunk(chunks[index], (uint32_t)vertexCount, out);
+    });
+
+    for (const ObjChunk& chunk : chunks) {
+        if (chunk.failed) {
+            std::cout << "OBJ file contains malformed vertices or faces" << std::endl;
+            return false;
+        }
+    };
+
+    SceneMesh mesh = {};
+    mesh.vertexCount = (uint32_t)vertexCount;
+    mesh.indexCount = (uint32_t)out.indexStorage.size();
+    out.meshes.push_back(mesh);
+    out.instances.push_back(SceneInstance());
+    return true;
+}
+
+struct JsonValue {
+    enum Type : uint8_t { Null, Bool, Number, String, Array, Object };
+    Type type = Null;
+    double number = 0.0;
+    // strings point into the source text, escape sequences are kept as is
+    const char* string = nullptr;
+    uint32_t stringLength = 0;
+    // set when the value is an object member
+    const char* key = nullptr;
+    uint32_t keyLength = 0;
+    // children of arrays and objects are stored contiguously in JsonDocument::children
+    uint32_t firstChild = 0;
+    uint32_t childCount = 0;
+};
+
+struct JsonDocument {
+    std::vector<JsonValue> values;
+    std::vector<uint32_t> children;
+};
+
+struct JsonParser {
+    const char* p = nullptr;
+    const char* end = nullptr;
+    JsonDocument* document = nullptr;
+};
+
+static void SkipJsonWhitespace(JsonParser& parser) {
+    while (parser.p < parser.end &&
+           (*parser.p == ' ' || *parser.p == '\t' || *parser.p == '\n' || *parser.p == '\r')) {
+        ++parser.p;
+    };
+}
+
+static bool ParseJsonString(JsonParser& parser, const char*& outString, uint32_t& outLength) {
+    if (parser.p >= parser.end || *parser.p != '"') {
+        return false;
+    }
+    const char* begin = ++parser.p;
+    while (parser.p < parser.end && *parser.p != '"') {
+        parser.p += *parser.p == '\\' ? 2 : 1;
+    };
+    if (parser.p >= parser.end) {
+        return false;
+    }
+    outString = begin;
+    outLength = (uint32_t)(parser.p - begin);
+    ++parser.p;
+    return true;
+}
+
+// returns the index of the parsed value or jsonNone on malformed input
+static uint32_t ParseJsonValue(JsonParser& parser, uint32_t depth) {
+    SkipJsonWhitespace(parser);
+    if (parser.p >= parser.end || depth > 64) {
+        return jsonNone;
+    }
+
+    std::vector<JsonValue>& values = parser.document->values;
+    const uint32_t index = (uint32_t)values.size();
+    values.push_back(JsonValue());
+
+    const char c = *parser.p;
+    if (c == '{' || c == '[') {
+        const bool isObject = c == '{';
+        const char closing = isObject ? '}' : ']';
+        ++parser.p;
+
+        // children are collected first since nested containers append their own children
+        std::vector<uint32_t> children;
+        SkipJsonWhitespace(parser);
+        if (parser.p < parser.end && *parser.p == closing) {
+            ++parser.p;
+        } else {
+            while (true) {
+                const char* key = nullptr;
+                uint32_t keyLength = 0;
+                if (isObject) {
+                    SkipJsonWhitespace(parser);
+                    if (!ParseJsonString(parser, key, keyLength)) {
+                        return jsonNone;
+                    }
+                    SkipJsonWhitespace(parser);
+                    if (parser.p >= parser.end || *parser.p != ':') {
+                        return jsonNone;
+                    }
+                    ++parser.p;
+                }
+                const uint32_t child = ParseJsonValue(parser, depth + 1);
+                if (child == jsonNone) {
+                    return jsonNone;
+                }
+                values[child].key = key;
+                values[child].keyLength = keyLength;
+                children.push_back(child);
+
+                SkipJsonWhitespace(parser);
+                if (parser.p < parser.end && *parser.p == ',') {
+                    ++parser.p;
+                } else if (parser.p < parser.end && *parser.p == closing) {
+                    ++parser.p;
+                    break;
+                } else {
+                    return jsonNone;
+                }
+            };
+        }
+
+        JsonValue& value = values[index];
+        value.type = isObject ? JsonValue::Object : JsonValue::Array;
+        value.firstChild = (uint32_t)parser.document->children.size();
+        value.childCount = (uint32_t)children.size();
+        parser.document->children.insert(parser.document->children.end(), children.begin(),
+                                         children.end());
+    } else if (c == '"') {
+        const char* string = nullptr;
+        uint32_t length = 0;
+        if (!ParseJsonString(parser, string, length)) {
+            return jsonNone;
+        }
+        values[index].type = JsonValue::String;
+        values[index].string = string;
+        values[index].stringLength = length;
+    } else if (c == 't' || c == 'f' || c == 'n') {
+        const char* literal = c == 't' ? "true" : (c == 'f' ? "false" : "null");
+        const size_t length = strlen(literal);
+        if ((size_t)(parser.end - parser.p) < length || strncmp(parser.p, literal, length) != 0) {
+            return jsonNone;
+        }
+        parser.p += length;
+        values[index].type = c == 'n' ? JsonValue::Null : JsonValue::Bool;
+        values[index].number = c == 't' ? 1.0 : 0.0;
+    } else {
+        double number = 0.0;
+        const char* begin = parser.p;
+        if (!ParseDouble(parser.p, parser.end, number) || parser.p == begin) {
+            return jsonNone;
+        }
+        values[index].type = JsonValue::Number;
+        values[index].number = number;
+    }
+    return index;
+}
+
+static bool ParseJson(const char* text, size_t length, JsonDocument& out) {
+    JsonParser parser = {};
+    parser.p = text;
+    parser.end = text + length;
+    parser.document = &out;
+    return ParseJsonValue(parser, 0) == 0;
+}
+
+static const JsonValue* JsonMember(const JsonDocument& document,
+                                   const JsonValue* object,
+                                   const char* key) {
+    if (object == nullptr || object->type != JsonValue::Object) {
+        return nullptr;
+    }
+    const size_t keyLength = strlen(key);
+    for (uint32_t ii = 0; ii < object->childCount; ++ii) {
+        const JsonValue& member = document.values[document.children[object->firstChild + ii]];
+        if (member.keyLength == keyLength && strncmp(member.key, key, keyLength) == 0) {
+            return &member;
+        }
+    };
+    return nullptr;
+}
+
+static const JsonValue* JsonElement(const JsonDocument& document,
+                                    const JsonValue* array,
+                                    uint32_t index) {
+    if (array == nullptr || array->type != JsonValue::Array || index >= array->childCount) {
+        return nullptr;
+    }
+    return &document.values[document.children[array->firstChild + index]];
+}
+
+static double JsonNumber(const JsonValue* value, double fallback) {
+    return value != nullptr && value->type == JsonValue::Number ? value->number : fallback;
+}
+
+// array indices referencing other glTF objects, jsonNone when missing, negative or fractional
+static uint32_t JsonIndex(const JsonValue* value) {
+    const double number = JsonNumber(value, -1.0);
+    if (!(number >= 0.0 && number < (double)jsonNone) || number != std::floor(number)) {
+        return jsonNone;
+    }
+    return (uint32_t)number;
+}
+
+// byte offsets and lengths, missing ones are 0, fails when negative, fractional or too large to
+// be exact in a double
+static bool JsonByteCount(const JsonValue* value, uint64_t& out) {
+    const double number = JsonNumber(value, 0.0);
+    if (!(number >= 0.0 && number <= 9007199254740992.0) || number != std::floor(number)) {
+        return false;
+    }
+    out = (uint64_t)number;
+    return true;
+}
+
+static bool JsonStringEquals(const JsonValue* value, const char* string) {
+    return value != nullptr && value->type == JsonValue::String &&
+           value->stringLength == strlen(string) &&
+           strncmp(value->string, string, value->stringLength) == 0;
+}
+
+// strided view of accessor data, validated against the bounds of its buffer
+struct GltfAccessor {
+    const uint8_t* data = nullptr;
+    uint32_t count = 0;
+    uint32_t stride = 0;
+    uint32_t componentType = 0;
+};
+
+const uint32_t gltfComponentUnsignedByte = 5121;
+const uint32_t gltfComponentUnsignedShort = 5123;
+const uint32_t gltfComponentUnsignedInt = 5125;
+const uint32_t gltfComponentFloat = 5126;
+
+static bool GetGltfAccessor(const JsonDocument& document,
+                            const std::vector<const uint8_t*>& bufferData,
+                            const std::vector<size_t>& bufferSizes,
+                            uint32_t accessorIndex,
+                            GltfAccessor& out) {
+    const JsonValue* root = &document.values[0];
+    const JsonValue* accessor =
+        JsonElement(document, JsonMember(document, root, "accessors"), accessorIndex);
+    if (accessor == nullptr) {
+        return false;
+    }
+    const uint32_t viewIndex = JsonIndex(JsonMember(document, accessor, "bufferView"));
+    const JsonValue* view =
+        JsonElement(document, JsonMember(document, root, "bufferViews"), viewIndex);
+    if (view == nullptr) {
+        return false;
+    }
+    const uint32_t bufferIndex = JsonIndex(JsonMember(document, view, "buffer"));
+    if (bufferIndex >= bufferData.size() || bufferData[bufferIndex] == nullptr) {
+        return false;
+    }
+
+    out.componentType = (uint32_t)JsonNumber(JsonMember(document, accessor, "componentType"), 0);
+    out.count = JsonIndex(JsonMember(document, accessor, "count"));
+    if (out.count == jsonNone) {
+        return false;
+    }
+
+    uint32_t elementSize = 0;
+    const JsonValue* type = JsonMember(document, accessor, "type");
+    if (JsonStringEquals(type, "VEC3") && out.componentType == gltfComponentFloat) {
+        elementSize = 12;
+    } else if (JsonStringEquals(type, "SCALAR") && out.componentType == gltfComponentUnsignedInt) {
+        elementSize = 4;
+    } else if (JsonStringEquals(type, "SCALAR") &&
+               out.componentType == gltfComponentUnsignedShort) {
+        elementSize = 2;
+    } else if (JsonStringEquals(type, "SCALAR") &&
+               out.componentType == gltfComponentUnsignedByte) {
+        elementSize = 1;
+    } else {
+        return false;
+    }
+    const JsonValue* byteStride = JsonMember(document, view, "byteStride");
+    out.stride = byteStride != nullptr ? JsonIndex(byteStride) : elementSize;
+    if (out.stride < elementSize) {
+        return false;
+    }
+
+    uint64_t viewOffset = 0;
+    uint64_t viewLength = 0;
+    uint64_t accessorOffset = 0;
+    if (!JsonByteCount(JsonMember(document, view, "byteOffset"), viewOffset) ||
+        !JsonByteCount(JsonMember(document, view, "byteLength"), viewLength) ||
+        !JsonByteCount(JsonMember(document, accessor, "byteOffset"), accessorOffset)) {
+        return false;
+    }
+    const uint64_t accessedBytes =
+        out.count == 0 ? 0 : accessorOffset + (uint64_t)(out.count - 1) * out.stride + elementSize;
+    if (viewOffset + viewLength > bufferSizes[bufferIndex] || accessedBytes > viewLength) {
+        return false;
+    }
+    out.data = bufferData[bufferIndex] + viewOffset + accessorOffset;
+    return true;
+}
+
+static uint32_t ReadGltfIndex(const GltfAccessor& accessor, uint32_t index) {
+    const uint8_t* element = accessor.data + (size_t)index * accessor.stride;
+    if (accessor.componentType == gltfComponentUnsignedInt) {
+        uint32_t value = 0;
+        memcpy(&value, element, 4);
+        return value;
+    } else if (accessor.componentType == gltfComponentUnsignedShort) {
+        uint16_t value = 0;
+        memcpy(&value, element, 2);
+        return value;
+    }
+    return element[0];
+}
+
+// column-major 4x4 matrices as used by glTF
+static void MultiplyMatrix(const float a[16], const float b[16], float out[16]) {
+    float result[16];
+    for (uint32_t column = 0; column < 4; ++column) {
+        for (uint32_t row = 0; row < 4; ++row) {
+            float sum = 0.0f;
+            for (uint32_t kk = 0; kk < 4; ++kk) {
+                sum += a[kk * 4 + row] * b[column * 4 + kk];
+            };
+            result[column * 4 + row] = sum;
+        };
+    };
+    memcpy(out, result, sizeof(result));
+}
+
+static void GetGltfNodeMatrix(const JsonDocument& document, const JsonValue* node, float out[16]) {
+    const JsonValue* matrix = JsonMember(document, node, "matrix");
+    if (matrix != nullptr && matrix->childCount == 16) {
+        for (uint32_t ii = 0; ii < 16; ++ii) {
+            out[ii] = (float)JsonNumber(JsonElement(document, matrix, ii), 0.0);
+        };
+        return;
+    }
+
+    const JsonValue* translation = JsonMember(document, node, "translation");
+    const JsonValue* rotation = JsonMember(document, node, "rotation");
+    const JsonValue* scale = JsonMember(document, node, "scale");
+    float t[3], r[4], s[3];
+    for (uint32_t ii = 0; ii < 3; ++ii) {
+        t[ii] = (float)JsonNumber(JsonElement(document, translation, ii), 0.0);
+        s[ii] = (float)JsonNumber(JsonElement(document, scale, ii), 1.0);
+    };
+    for (uint32_t ii = 0; ii < 4; ++ii) {
+        r[ii] = (float)JsonNumber(JsonElement(document, rotation, ii), ii == 3 ? 1.0 : 0.0);
+    };
+
+    // T * R * S with the rotation quaternion stored as x, y, z, w
+    const float x = r[0], y = r[1], z = r[2], w = r[3];
+    const float rotationMatrix[9] = {1 - 2 * (y * y + z * z), 2 * (x * y + z * w),
+                                     2 * (x * z - y * w),     2 * (x * y - z * w),
+                                     1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+                                     2 * (x * z + y * w),     2 * (y * z - x * w),
+                                     1 - 2 * (x * x + y * y)};
+    for (uint32_t column = 0; column < 3; ++column) {
+        for (uint32_t row = 0; row < 3; ++row) {
+            out[column * 4 + row] = rotationMatrix[column * 3 + row] * s[column];
+        };
+        out[column * 4 + 3] = 0.0f;
+    };
+    out[12] = t[0];
+    out[13] = t[1];
+    out[14] = t[2];
+    out[15] = 1.0f;
+}
+
+// one scene mesh per triangle primitive of a glTF mesh
+struct GltfMeshRange {
+    uint32_t firstSceneMesh = 0;
+    uint32_t sceneMeshCount = 0;
+};
+
+static void AddGltfInstances(const JsonDocument& document,
+                             const std::vector<GltfMeshRange>& meshRanges,
+                             uint32_t nodeIndex,
+                             const float parentMatrix[16],
+                             uint32_t depth,
+                             Scene& out) {
+    const JsonValue* root = &document.values[0];
+    const JsonValue* node = JsonElement(document, JsonMember(document, root, "nodes"), nodeIndex);
+    if (node == nullptr || depth > 64) {
+        return;
+    }
+
+    float localMatrix[16];
+    float worldMatrix[16];
+    GetGltfNodeMatrix(document, node, localMatrix);
+    MultiplyMatrix(parentMatrix, localMatrix, worldMatrix);
+
+    const uint32_t meshIndex = JsonIndex(JsonMember(document, node, "mesh"));
+    if (meshIndex < meshRanges.size()) {
+        const GltfMeshRange& range = meshRanges[meshIndex];
+        for (uint32_t ii = 0; ii < range.sceneMeshCount; ++ii) {
+            SceneInstance instance = {};
+            for (uint32_t row = 0; row < 3; ++row) {
+                for (uint32_t column = 0; column < 4; ++column) {
+                    instance.transform[row][column] = worldMatrix[column * 4 + row];
+                };
+            };
+            instance.meshIndex = range.firstSceneMesh + ii;
+            out.instances.push_back(instance);
+        };
+    }
+
+    const JsonValue* children = JsonMember(document, node, "children");
+    for (uint32_t ii = 0; children != nullptr && ii < children->childCount; ++ii) {
+        const uint32_t childIndex = JsonIndex(JsonElement(document, children, ii));
+        AddGltfInstances(document, meshRanges, childIndex, worldMatrix, depth + 1, out);
+    };
+}
+
+// a slice of one primitive's vertices or indices, copied by one task
+struct GltfCopyTask {
+    uint32_t sceneMesh = 0;
+    bool indices = false;
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+static bool LoadGltf(ThreadPool& pool,
+                     const MappedFile& file,
+                     const std::string& path,
+                     bool binary,
+                     Scene& out,
+                     uint64_t& bytesRead) {
+    const char* json = reinterpret_cast<const char*>(file.data);
+    size_t jsonLength = file.size;
+    const uint8_t* binaryChunk = nullptr;
+    size_t binaryChunkLength = 0;
+
+    // GLB: 12 byte header followed by a JSON chunk and an optional BIN chunk
+    if (binary) {
+        uint32_t header[3] = {};
+        uint32_t chunkHeader[2] = {};
+        if (file.size < 20) {
+            return false;
+        }
+        memcpy(header, file.data, sizeof(header));
+        memcpy(chunkHeader, file.data + 12, sizeof(chunkHeader));
+        if (header[0] != 0x46546C67 || header[1] != 2 || chunkHeader[1] != 0x4E4F534A ||
+            20 + (size_t)chunkHeader[0] > file.size) {
+            std::cout << "Unsupported GLB header" << std::endl;
+            return false;
+        }
+        json = reinterpret_cast<const char*>(file.data + 20);
+        jsonLength = chunkHeader[0];
+
+        const size_t binaryChunkOffset = 20 + (size_t)jsonLength;
+        if (binaryChunkOffset + 8 <= file.size) {
+            memcpy(chunkHeader, file.data + binaryChunkOffset, sizeof(chunkHeader));
+            if (chunkHeader[1] == 0x004E4942 &&
+                binaryChunkOffset + 8 + (size_t)chunkHeader[0] <= file.size) {
+                binaryChunk = file.data + binaryChunkOffset + 8;
+                binaryChunkLength = chunkHeader[0];
+            }
+        }
+    }
+
+    JsonDocument document;
+    if (!ParseJson(json, jsonLength, document)) {
+        std::cout << "Malformed glTF JSON" << std::endl;
+        return false;
+    }
+    const JsonValue* root = &document.values[0];
+
+    // external buffers are mapped as well, embedded base64 data is not supported
+    const std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+    const JsonValue* buffers = JsonMember(document, root, "buffers");
+    const uint32_t bufferCount = buffers != nullptr ? buffers->childCount : 0;
+    std::vector<MappedFile> bufferFiles(bufferCount);
+    std::vector<const uint8_t*> bufferData(bufferCount, nullptr);
+    std::vector<size_t> bufferSizes(bufferCount, 0);
+    bool buffersValid = true;
+    for (uint32_t ii = 0; ii < bufferCount; ++ii) {
+        const JsonValue* uri = JsonMember(document, JsonElement(document, buffers, ii), "uri");
+        if (uri == nullptr && binary && ii == 0) {
+            bufferData[ii] = binaryChunk;
+            bufferSizes[ii] = binaryChunkLength;
+        } else if (uri != nullptr && uri->type == JsonValue::String &&
+                   strncmp(uri->string, "data:", std::min(5u, uri->stringLength)) != 0) {
+            const std::string bufferPath = directory + std::string(uri->string, uri->stringLength);
+            if (OpenMappedFile(bufferPath, bufferFiles[ii])) {
+                bufferData[ii] = bufferFiles[ii].data;
+                bufferSizes[ii] = bufferFiles[ii].size;
+                bytesRead += bufferFiles[ii].size;
+            } else {
+                buffersValid = false;
+            }
+        } else {
+            std::cout << "Embedded glTF buffers are not supported" << std::endl;
+            buffersValid = false;
+        }
+    };
+
+    // first pass, resolve accessors and count so every primitive gets its output range
+    std::vector<GltfAccessor> positionAccessors;
+    std::vector<GltfAccessor> indexAccessors;
+    std::vector<GltfMeshRange> meshRanges;
+    const JsonValue* meshes = JsonMember(document, root, "meshes");
+    uint64_t vertexCount = 0;
+    uint64_t indexCount = 0;
+    const uint32_t meshCount = buffersValid && meshes != nullptr ? meshes->childCount : 0;
+    for (uint32_t meshIndex = 0; meshIndex < meshCount; ++meshIndex) {
+        const JsonValue* primitives =
+            JsonMember(document, JsonElement(document, meshes, meshIndex), "primitives");
+
+        GltfMeshRange range = {};
+        range.firstSceneMesh = (uint32_t)out.meshes.size();
+        for (uint32_t ii = 0; primitives != nullptr && ii < primitives->childCount; ++ii) {
+            const JsonValue* primitive = JsonElement(document, primitives, ii);
+            // only triangle lists can be built into acceleration structures directly
+            if (JsonNumber(JsonMember(document, primitive, "mode"), 4) != 4) {
+                continue;
+            }
+            const JsonValue* attributes = JsonMember(document, primitive, "attributes");
+            const JsonValue* position = JsonMember(document, attributes, "POSITION");
+            const JsonValue* indices = JsonMember(document, primitive, "indices");
+
+            GltfAccessor positionAccessor = {};
+            GltfAccessor indexAccessor = {};
+            if (!GetGltfAccessor(document, bufferData, bufferSizes,
+                                 JsonIndex(position), positionAccessor) ||
+                positionAccessor.componentType != gltfComponentFloat ||
+                (indices != nullptr &&
+                 (!GetGltfAccessor(document, bufferData, bufferSizes,
+                                   JsonIndex(indices), indexAccessor) ||
+                  indexAccessor.componentType == gltfComponentFloat))) {
+                std::cout << "Skipping glTF primitive with invalid accessors" << std::endl;
+                continue;
+            }
+
+            SceneMesh mesh = {};
+            mesh.firstVertex = (uint32_t)vertexCount;
+            mesh.vertexCount = positionAccessor.count;
+            mesh.firstIndex = (uint32_t)indexCount;
+            mesh.indexCount = indices != nullptr ? indexAccessor.count : positionAccessor.count;
+            mesh.indexCount -= mesh.indexCount % 3;
+            vertexCount += mesh.vertexCount;
+            indexCount += mesh.indexCount;
+
+            out.meshes.push_back(mesh);
+            positionAccessors.push_back(positionAccessor);
+            indexAccessors.push_back(indexAccessor);
+        };
+        range.sceneMeshCount = (uint32_t)out.meshes.size() - range.firstSceneMesh;
+        meshRanges.push_back(range);
+    };
+
+    bool valid = buffersValid && vertexCount <= UINT32_MAX && indexCount <= UINT32_MAX;
+    if (valid) {
+        out.positionStorage.resize((size_t)vertexCount * 3);
+        out.indexStorage.resize((size_t)indexCount);
+
+        std::vector<GltfCopyTask> tasks;
+        for (uint32_t ii = 0; ii < out.meshes.size(); ++ii) {
+            for (uint32_t begin = 0; begin < out.meshes[ii].vertexCount;
+                 begin += gltfCopyBatchSize) {
+                tasks.push_back({ii, false, begin,
+                                 std::min(begin + gltfCopyBatchSize, out.meshes[ii].vertexCount)});
+            };
+            for (uint32_t begin = 0; begin < out.meshes[ii].indexCount;
+                 begin += gltfCopyBatchSize) {
+                tasks.push_back({ii, true, begin,
+                                 std::min(begin + gltfCopyBatchSize, out.meshes[ii].indexCount)});
+            };
+        };
+
+        // second pass, copy and widen straight into the scene arrays
+        std::atomic<bool> indicesValid(true);
+        RunParallel(pool, (uint32_t)tasks.size(), [&](uint32_t taskIndex, uint32_t) {
+            const GltfCopyTask& task = tasks[taskIndex];
+            const SceneMesh& mesh = out.meshes[task.sceneMesh];
+            if (!task.indices) {
+                const GltfAccessor& accessor = positionAccessors[task.sceneMesh];
+                float* dst =
+                    out.positionStorage.data() + ((size_t)mesh.firstVertex + task.begin) * 3;
+                for (uint32_t ii = task.begin; ii < task.end; ++ii, dst += 3) {
+                    memcpy(dst, accessor.data + (size_t)ii * accessor.stride, 12);
+                };
+                return;
+            }
+            uint32_t* dst = out.indexStorage.data() + mesh.firstIndex + task.begin;
+            const GltfAccessor& accessor = indexAccessors[task.sceneMesh];
+            for (uint32_t ii = task.begin; ii < task.end; ++ii, ++dst) {
+                *dst = accessor.data != nullptr ? ReadGltfIndex(accessor, ii) : ii;
+                if (*dst >= mesh.vertexCount) {
+                    indicesValid = false;
+                    *dst = 0;
+                }
+            };
+        });
+        if (!indicesValid) {
+            std::cout << "glTF file contains out of range indices" << std::endl;
+            valid = false;
+        }
+    }
+
+    if (valid) {
+        const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+        const JsonValue* scenes = JsonMember(document, root, "scenes");
+        const JsonValue* defaultScene = JsonMember(document, root, "scene");
+        const uint32_t sceneIndex = defaultScene != nullptr ? JsonIndex(defaultScene) : 0;
+        const JsonValue* sceneNodes =
+            JsonMember(document, JsonElement(document, scenes, sceneIndex), "nodes");
+        for (uint32_t ii = 0; sceneNodes != nullptr && ii < sceneNodes->childCount; ++ii) {
+            const uint32_t nodeIndex = JsonIndex(JsonElement(document, sceneNodes, ii));
+            AddGltfInstances(document, meshRanges, nodeIndex, identity, 0, out);
+        };
+        // without a scene graph every mesh is placed once at the origin
+        if (sceneNodes == nullptr) {
+            for (uint32_t ii = 0; ii < out.meshes.size(); ++ii) {
+                SceneInstance instance = {};
+                instance.meshIndex = ii;
+                out.instances.push_back(instance);
+            };
+        }
+    }
+
+    for (MappedFile& bufferFile : bufferFiles) {
+        CloseMappedFile(bufferFile);
+    };
+    return valid;
+}
+
+static bool EndsWith(const std::string& value, const char* suffix) {
+    const size_t length = strlen(suffix);
+    if (value.size() < length) {
+        return false;
+    }
+    for (size_t ii = 0; ii < length; ++ii) {
+        const char c = value[value.size() - length + ii];
+        if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != suffix[ii]) {
+            return false;
+        }
+    };
+    return true;
+}
+
+const uint32_t sceneCacheMagic = 0x43535452;  // "RTSC"
+const uint32_t sceneCacheVersion = 1;
+// every section starts at a multiple of this, so the mapped arrays are suitably aligned
+const uint64_t sceneCacheAlignment = 64;
+
+// little-endian header of a .rtcache file, followed by the position, index, mesh and instance
+// sections. meshes and instances are stored as their in-memory structs
+struct SceneCacheHeader {
+    uint32_t magic = sceneCacheMagic;
+    uint32_t version = sceneCacheVersion;
+    // identifies the source file the cache was written from
+    uint64_t sourceSize = 0;
+    int64_t sourceModifiedTime = 0;
+    uint64_t sourceHash = 0;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    uint32_t meshCount = 0;
+    uint32_t instanceCount = 0;
+    uint64_t positionsOffset = 0;
+    uint64_t indicesOffset = 0;
+    uint64_t meshesOffset = 0;
+    uint64_t instancesOffset = 0;
+    uint64_t fileSize = 0;
+};
+
+static_assert(sizeof(SceneMesh) == 16, "SceneMesh layout is part of the cache format");
+static_assert(sizeof(SceneInstance) == 52, "SceneInstance layout is part of the cache format");
+
+struct SceneSourceKey {
+    uint64_t size = 0;
+    int64_t modifiedTime = 0;
+    uint64_t hash = 0;
+};
+
+static bool IsLittleEndian() {
+    const uint16_t value = 1;
+    uint8_t firstByte = 0;
+    memcpy(&firstByte, &value, 1);
+    return firstByte == 1;
+}
+
+static uint64_t AlignSceneCacheOffset(uint64_t offset) {
+    return (offset + sceneCacheAlignment - 1) & ~(sceneCacheAlignment - 1);
+}
+
+// hashing every byte would cost as much as parsing, so only evenly spread blocks are hashed and
+// size and modification time catch the rest. small files are hashed completely
+static bool GetSceneSourceKey(const std::string& path, SceneSourceKey& out) {
+    const uint64_t blockSize = 4096;
+    const uint64_t blockCount = 64;
+
+    if (!GetFileInfo(path, out.size, out.modifiedTime)) {
+        return false;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    std::vector<char> block(blockSize);
+    for (uint64_t ii = 0; ii < blockCount; ++ii) {
+        const uint64_t offset = out.size <= blockSize * blockCount
+                                    ? ii * blockSize
+                                    : (out.size - blockSize) * ii / (blockCount - 1);
+        if (offset >= out.size) {
+            break;
+        }
+        file.seekg((std::streamoff)offset);
+        file.read(block.data(), (std::streamsize)std::min(blockSize, out.size - offset));
+        const std::streamsize readCount = file.gcount();
+        for (std::streamsize bb = 0; bb < readCount; ++bb) {
+            hash = (hash ^ (uint8_t)block[bb]) * 1099511628211ull;
+        };
+    };
+    out.hash = hash;
+    return true;
+}
+
+static bool IsSceneCacheSectionValid(const SceneCacheHeader& header,
+                                     uint64_t offset,
+                                     uint64_t count,
+                                     uint64_t elementSize) {
+    return offset % sceneCacheAlignment == 0 && offset >= sizeof(SceneCacheHeader) &&
+           offset <= header.fileSize && count * elementSize <= header.fileSize - offset;
+}
+
+// maps the cache and points the scene straight at its sections, nothing is parsed or copied
+// except the small mesh and instance tables
+static bool LoadSceneCache(const std::string& cachePath, const SceneSourceKey& key, Scene& out) {
+    uint64_t cacheSize = 0;
+    int64_t cacheModifiedTime = 0;
+    if (!GetFileInfo(cachePath, cacheSize, cacheModifiedTime) ||
+        cacheSize < sizeof(SceneCacheHeader)) {
+        return false;
+    }
+
+    MappedFile file;
+    if (!OpenMappedFile(cachePath, file)) {
+        return false;
+    }
+    SceneCacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+
+    bool valid = header.magic == sceneCacheMagic && header.version == sceneCacheVersion &&
+                 header.sourceSize == key.size && header.sourceModifiedTime == key.modifiedTime &&
+                 header.sourceHash == key.hash && header.fileSize == file.size;
+    valid = valid &&
+            IsSceneCacheSectionValid(header, header.positionsOffset, header.vertexCount,
+                                     sizeof(float) * 3) &&
+            IsSceneCacheSectionValid(header, header.indicesOffset, header.indexCount,
+                                     sizeof(uint32_t)) &&
+            IsSceneCacheSectionValid(header, header.meshesOffset, header.meshCount,
+                                     sizeof(SceneMesh)) &&
+            IsSceneCacheSectionValid(header, header.instancesOffset, header.instanceCount,
+                                     sizeof(SceneInstance));
+    if (!valid) {
+        std::cout << "Scene cache " << cachePath << " is stale, reparsing" << std::endl;
+        CloseMappedFile(file);
+        return false;
+    }
+
+    out.meshes.resize(header.meshCount);
+    out.instances.resize(header.instanceCount);
+    memcpy(out.meshes.data(), file.data + header.meshesOffset,
+           sizeof(SceneMesh) * header.meshCount);
+    memcpy(out.instances.data(), file.data + header.instancesOffset,
+           sizeof(SceneInstance) * header.instanceCount);
+
+    for (const SceneMesh& mesh : out.meshes) {
+        valid = valid && (uint64_t)mesh.firstVertex + mesh.vertexCount <= header.vertexCount &&
+                (uint64_t)mesh.firstIndex + mesh.indexCount <= header.indexCount;
+    };
+    for (const SceneInstance& instance : out.instances) {
+        valid = valid && instance.meshIndex < header.meshCount;
+    };
+    if (!valid || out.meshes.empty() || out.instances.empty()) {
+        std::cout << "Scene cache " << cachePath << " is corrupt, reparsing" << std::endl;
+        CloseMappedFile(file);
+        out = Scene();
+        return false;
+    }
+
+    out.positions = reinterpret_cast<const float*>(file.data + header.positionsOffset);
+    out.vertexCount = header.vertexCount;
+    out.indices = reinterpret_cast<const uint32_t*>(file.data + header.indicesOffset);
+    out.indexCount = header.indexCount;
+    out.cacheFile = file;
+    return true;
+}
+
+// written to a temporary file first so an interrupted write never leaves a truncated cache
+static void WriteSceneCache(const std::string& cachePath,
+                            const SceneSourceKey& key,
+                            const Scene& scene) {
+    SceneCacheHeader header;
+    header.sourceSize = key.size;
+    header.sourceModifiedTime = key.modifiedTime;
+    header.sourceHash = key.hash;
+    header.vertexCount = scene.vertexCount;
+    header.indexCount = scene.indexCount;
+    header.meshCount = (uint32_t)scene.meshes.size();
+    header.instanceCount = (uint32_t)scene.instances.size();
+    header.positionsOffset = AlignSceneCacheOffset(sizeof(SceneCacheHeader));
+    header.indicesOffset = AlignSceneCacheOffset(header.positionsOffset +
+                                                 sizeof(float) * 3 * (uint64_t)scene.vertexCount);
+    header.meshesOffset =
+        AlignSceneCacheOffset(header.indicesOffset + sizeof(uint32_t) * (uint64_t)scene.indexCount);
+    header.instancesOffset =
+        AlignSceneCacheOffset(header.meshesOffset + sizeof(SceneMesh) * scene.meshes.size());
+    header.fileSize = header.instancesOffset + sizeof(SceneInstance) * scene.instances.size();
+
+    const std::string tempPath = cachePath + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    uint64_t written = 0;
+    auto writeSection = [&](uint64_t offset, const void* data, uint64_t size) {
+        const char padding[sceneCacheAlignment] = {};
+        file.write(padding, (std::streamsize)(offset - written));
+        file.write(static_cast<const char*>(data), (std::streamsize)size);
+        written = offset + size;
+    };
+    writeSection(0, &header, sizeof(header));
+    writeSection(header.positionsOffset, scene.positions,
+                 sizeof(float) * 3 * (uint64_t)scene.vertexCount);
+    writeSection(header.indicesOffset, scene.indices,
+                 sizeof(uint32_t) * (uint64_t)scene.indexCount);
+    writeSection(header.meshesOffset, scene.meshes.data(),
+                 sizeof(SceneMesh) * scene.meshes.size());
+    writeSection(header.instancesOffset, scene.instances.data(),
+                 sizeof(SceneInstance) * scene.instances.size());
+    file.close();
+
+    if (!file) {
+        std::cout << "Could not write scene cache " << cachePath << std::endl;
+        std::remove(tempPath.c_str());
+        return;
+    }
+    // rename does not replace existing files on every platform
+    std::remove(cachePath.c_str());
+    if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        std::cout << "Could not write scene cache " << cachePath << std::endl;
+        std::remove(tempPath.c_str());
+        return;
+    }
+    std::cout << "Wrote scene cache " << cachePath << " (" << (header.fileSize / 1024) << " KiB)"
+              << std::endl;
+}
+
+static void PrintSceneStats(const std::string& path,
+                            const Scene& scene,
+                            bool fromCache,
+                            double seconds) {
+    std::cout << "Loaded " << path << (fromCache ? " from cache" : "") << ": "
+              << scene.vertexCount << " vertices, " << (scene.indexCount / 3) << " triangles, "
+              << scene.meshes.size() << " meshes, " << scene.instances.size() << " instances in "
+              << (seconds * 1000.0) << "ms" << std::endl;
+}
+
+void UseSceneStorage(Scene& scene) {
+    scene.positions = scene.positionStorage.data();
+    scene.vertexCount = (uint32_t)(scene.positionStorage.size() / 3);
+    scene.indices = scene.indexStorage.data();
+    scene.indexCount = (uint32_t)scene.indexStorage.size();
+}
+
+void ReleaseScene(Scene& scene) {
+    CloseMappedFile(scene.cacheFile);
+    std::vector<float>().swap(scene.positionStorage);
+    std::vector<uint32_t>().swap(scene.indexStorage);
+    scene.positions = nullptr;
+    scene.vertexCount = 0;
+    scene.indices = nullptr;
+    scene.indexCount = 0;
+}
+
+bool LoadScene(ThreadPool& pool, const std::string& path, bool useCache, Scene& out) {
+    ReleaseScene(out);
+    out = Scene();
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    SceneSourceKey key;
+    const std::string cachePath = path + ".rtcache";
+    const bool cacheable = useCache && IsLittleEndian() && GetSceneSourceKey(path, key);
+    if (cacheable && LoadSceneCache(cachePath, key, out)) {
+        auto end = std::chrono::high_resolution_clock::now();
+        PrintSceneStats(path, out, true, std::chrono::duration<double>(end - start).count());
+        return true;
+    }
+
+    MappedFile file;
+    if (!OpenMappedFile(path, file)) {
+        return false;
+    }
+    uint64_t bytesRead = file.size;
+
+    bool result = false;
+    if (EndsWith(path, ".obj")) {
+        result = LoadObj(pool, file, out);
+    } else if (EndsWith(path, ".gltf")) {
+        result = LoadGltf(pool, file, path, false, out, bytesRead);
+    } else if (EndsWith(path, ".glb")) {
+        result = LoadGltf(pool, file, path, true, out, bytesRead);
+    } else {
+        std::cout << "Unsupported scene format " << path << std::endl;
+    }
+    CloseMappedFile(file);
+
+    if (!result || out.meshes.empty() || out.instances.empty()) {
+        std::cout << "Failed to load scene " << path << std::endl;
+        out = Scene();
+        return false;
+    }
+    UseSceneStorage(out);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const double triangleCount = (double)out.indexCount / 3.0;
+
+    PrintSceneStats(path, out, false, seconds);
+    std::cout << "Parse throughput: " << ((double)bytesRead / seconds / (1024.0 * 1024.0))
+              << " MB/s, " << (triangleCount / seconds / 1e6) << " Mtris/s" << std::endl;
+
+    if (cacheable) {
+        WriteSceneCache(cachePath, key, out);
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// a range of the scene's flat vertex and index arrays, indices are relative to firstVertex
+struct SceneMesh {
+    uint32_t firstVertex = 0;
+    uint32_t vertexCount = 0;
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+};
+
+// row-major 3x4 transform, laid out like VkTransformMatrixKHR
+struct SceneInstance {
+    float transform[3][4] = {{1.0f, 0.0f, 0.0f, 0.0f},
+                             {0.0f, 1.0f, 0.0f, 0.0f},
+                             {0.0f, 0.0f, 1.0f, 0.0f}};
+    uint32_t meshIndex = 0;
+};
+
+// all meshes share one position and one index array so they can be uploaded in one go
+struct Scene {
+    // xyz per vertex, tightly packed
+    const float* positions = nullptr;
+    uint32_t vertexCount = 0;
+    const uint32_t* indices = nullptr;
+    uint32_t indexCount = 0;
+    std::vector<SceneMesh> meshes;
+    std::vector<SceneInstance> instances;
+    // positions and indices point either into these after parsing or into the mapped cache file
+    std::vector<float> positionStorage;
+    std::vector<uint32_t> indexStorage;
+    MappedFile cacheFile;
+};
+
+// loads .obj, .gltf or .glb files, picking the parser by file extension and parsing on the
+// threads of pool. with useCache a binary copy is written next to the source and mapped instead
+// of parsing on later loads
+bool LoadScene(ThreadPool& pool, const std::string& path, bool useCache, Scene& out);
+
+// points positions and indices at the parsed storage
+void UseSceneStorage(Scene& scene);
+
+// frees parsed storage and unmaps the cache file, positions and indices become invalid
+void ReleaseScene(Scene& scene);
@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+// pulls tasks of the current batch until there are none left
+static void RunTasks(ThreadPool& pool, const ThreadPoolTask& task, uint32_t threadIndex) {
+    for (uint32_t index = pool.nextTask++; index < pool.taskCount; index = pool.nextTask++) {
+        task(index, threadIndex);
+    };
+}
+
+static void WorkerLoop(ThreadPool& pool, uint32_t threadIndex) {
+    uint64_t lastBatch = 0;
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    while (true) {
+        pool.workAvailable.wait(lock,
+                                [&]() { return pool.stopping || pool.batchIndex != lastBatch; });
+        if (pool.stopping) {
+            return;
+        }
+        lastBatch = pool.batchIndex;
+        // the batch may already have been finished by the other threads
+        const ThreadPoolTask* task = pool.task;
+        if (task == nullptr) {
+            continue;
+        }
+        ++pool.busyWorkers;
+
+        lock.unlock();
+        RunTasks(pool, *task, threadIndex);
+        lock.lock();
+
+        if (--pool.busyWorkers == 0) {
+            pool.workDone.notify_all();
+        }
+    };
+}
+
+void CreateThreadPool(ThreadPool& pool, uint32_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    pool.stopping = false;
+    for (uint32_t ii = 1; ii < threadCount; ++ii) {
+        pool.workers.emplace_back(WorkerLoop, std::ref(pool), ii);
+    };
+}
+
+void DestroyThreadPool(ThreadPool& pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stopping = true;
+    }
+    pool.workAvailable.notify_all();
+    for (std::thread& worker : pool.workers) {
+        worker.join();
+    };
+    pool.workers.clear();
+}
+
+uint32_t GetThreadCount(const ThreadPool& pool) {
+    return (uint32_t)pool.workers.size() + 1;
+}
+
+void RunParallel(ThreadPool& pool, uint32_t taskCount, const ThreadPoolTask& task) {
+    if (taskCount == 0) {
+        return;
+    }
+    // a single task or an empty pool is not worth waking anyone up for
+    if (taskCount == 1 || pool.workers.empty()) {
+        for (uint32_t ii = 0; ii < taskCount; ++ii) {
+            task(ii, 0);
+        };
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.task = &task;
+        pool.taskCount = taskCount;
+        pool.nextTask = 0;
+        ++pool.batchIndex;
+    }
+    pool.workAvailable.notify_all();
+
+    RunTasks(pool, task, 0);
+
+    // workers that woke up late find no tasks left, but may still be finishing their last one
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.workDone.wait(lock, [&]() { return pool.busyWorkers == 0; });
+    pool.task = nullptr;
+    pool.taskCount = 0;
+}
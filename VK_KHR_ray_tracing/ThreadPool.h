@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// called with the task index and the index of the thread running it, thread 0 is the caller
+typedef std::function<void(uint32_t taskIndex, uint32_t threadIndex)> ThreadPoolTask;
+
+// persistent worker threads that run batches of indexed tasks, the calling thread helps out
+// so a batch makes progress even when all workers are busy
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workDone;
+    // the batch currently being run, guarded by mutex except for the task counter
+    const ThreadPoolTask* task = nullptr;
+    uint32_t taskCount = 0;
+    std::atomic<uint32_t> nextTask{0};
+    uint32_t busyWorkers = 0;
+    uint64_t batchIndex = 0;
+    bool stopping = false;
+};
+
+// threadCount includes the calling thread, 0 uses one thread per hardware thread
+void CreateThreadPool(ThreadPool& pool, uint32_t threadCount);
+
+void DestroyThreadPool(ThreadPool& pool);
+
+uint32_t GetThreadCount(const ThreadPool& pool);
+
+// runs task(0 .. taskCount - 1) and returns once all of them have finished
+void RunParallel(ThreadPool& pool, uint32_t taskCount, const ThreadPoolTask& task);
@@ -1,15 +1,46 @@
-#include <Windows.h>
+#ifdef _WIN32
+#    include <Windows.h>
+#endif
 
 #define VK_ENABLE_BETA_EXTENSIONS
-#define VK_USE_PLATFORM_WIN32_KHR
-#include <Shlwapi.h>
-#include <pathcch.h>
+#ifdef _WIN32
+#    define VK_USE_PLATFORM_WIN32_KHR
+#    include <Shlwapi.h>
+#    include <pathcch.h>
+#else
+#    include <limits.h>
+#    include <unistd.h>
+#endif
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
+#include "CpuRayCast.h"
+#include "CpuRenderer.h"
+#include "MappedFile.h"
+#include "SceneLoader.h"
+#include "ThreadPool.h"
+
+// compiled into the binary with glslangValidator --vn, see shaders/compile.bat
+#ifdef EMBED_SPIRV
+#    include "../shaders/ray-closest-hit.spv.h"
+#    include "../shaders/ray-generation.spv.h"
+#    include "../shaders/ray-miss.spv.h"
+#endif
+
 #define ASSERT_VK_RESULT(r)                                                                    \
     {                                                                                          \
         VkResult result = (r);                                                                 \
@@ -21,96 +52,425 @@
 
 #define RESOLVE_VK_INSTANCE_PFN(instance, funcName)                                          \
     {                                                                                        \
-        funcName =                                                                           \
+        ext::funcName =                                                                      \
             reinterpret_cast<PFN_##funcName>(vkGetInstanceProcAddr(instance, "" #funcName)); \
-        if (funcName == nullptr) {                                                           \
+        if (ext::funcName == nullptr) {                                                      \
             const std::string name = #funcName;                                              \
             std::cout << "Failed to resolve function " << name << std::endl;                 \
         }                                                                                    \
     }
 
-#define RESOLVE_VK_DEVICE_PFN(device, funcName)                                                 \
-    {                                                                                           \
-        funcName = reinterpret_cast<PFN_##funcName>(vkGetDeviceProcAddr(device, "" #funcName)); \
-        if (funcName == nullptr) {                                                              \
-            const std::string name = #funcName;                                                 \
-            std::cout << "Failed to resolve function " << name << std::endl;                    \
-        }                                                                                       \
+#define RESOLVE_VK_DEVICE_PFN(device, funcName)                                              \
+    {                                                                                        \
+        ext::funcName =                                                                      \
+            reinterpret_cast<PFN_##funcName>(vkGetDeviceProcAddr(device, "" #funcName));     \
+        if (ext::funcName == nullptr) {                                                      \
+            const std::string name = #funcName;                                              \
+            std::cout << "Failed to resolve function " << name << std::endl;                 \
+        }                                                                                    \
     }
 
-static std::vector<char> readFile(const std::string& filename) {
-    printf("Reading %s\n", filename.c_str());
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open()) {
-        throw std::runtime_error("Could not open file");
-    }
+// a range of device memory sub-allocated from one of the memory pool blocks
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t memoryTypeIndex = 0;
+    uint32_t blockIndex = 0;
+    void* mappedData = nullptr;
+};
 
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<char> buffer(fileSize);
+struct MemoryRange {
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+};
 
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-    file.close();
+struct MemoryBlock {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    void* mappedData = nullptr;
+    // sorted by offset, adjacent ranges are always merged
+    std::vector<MemoryRange> freeRanges;
+};
 
-    return buffer;
-}
+struct MemoryPool {
+    std::vector<MemoryBlock> blocks;
+};
 
 struct AccelerationMemory {
     VkBuffer buffer = VK_NULL_HANDLE;
-    VkDeviceMemory memory = VK_NULL_HANDLE;
+    MemoryAllocation allocation;
     uint64_t deviceAddress = 0;
 };
 
 typedef struct AccelerationMemory MappedBuffer;
 
+struct Vertex {
+    float pos[3];
+};
+
+// triangle geometry of a single mesh which lives in device addressable buffers
+struct MeshGeometry {
+    uint64_t vertexBufferAddress = 0;
+    uint32_t vertexCount = 0;
+    uint32_t vertexStride = sizeof(Vertex);
+    uint64_t indexBufferAddress = 0;
+    uint32_t indexCount = 0;
+    // the same geometry in host memory, read by host builds
+    const void* vertexData = nullptr;
+    const void* indexData = nullptr;
+};
+
+struct TopLevelAccelerationStructure {
+    VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
+    AccelerationMemory memory;
+    VkDeviceSize size = 0;
+    uint64_t deviceAddress = 0;
+    VkBuildAccelerationStructureFlagsKHR flags = 0;
+    uint32_t instanceCount = 0;
+    // ring of persistently mapped instance buffers, one per frame in flight when dynamic
+    std::vector<MappedBuffer> instanceBuffers;
+    // rebuilds and updates take this much from the start of the scratch pool
+    VkDeviceSize scratchSize = 0;
+};
+
+// one growable device local buffer that every device build takes its scratch memory from, builds
+// recorded together get disjoint aligned ranges and the next batch reuses them after a barrier
+struct ScratchPool {
+    AccelerationMemory memory;
+    VkDeviceSize capacity = 0;
+    // memory.deviceAddress rounded up to minAccelerationStructureScratchOffsetAlignment
+    VkDeviceAddress baseAddress = 0;
+    // last main queue submission that built with the pool
+    uint64_t lastUseValue = 0;
+};
+
+struct BottomLevelAccelerationStructure {
+    VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
+    AccelerationMemory memory;
+    VkDeviceSize size = 0;
+    uint64_t deviceAddress = 0;
+};
+
+// a shader group handle followed by inline data the shader can read through shaderRecordEXT
+struct ShaderRecord {
+    uint32_t groupIndex = 0;
+    std::vector<uint8_t> data;
+};
+
+// all records packed into a single device local buffer, one region per shader stage
+struct ShaderBindingTable {
+    AccelerationMemory memory;
+    VkStridedDeviceAddressRegionKHR rayGenRegion = {};
+    VkStridedDeviceAddressRegionKHR missRegion = {};
+    VkStridedDeviceAddressRegionKHR hitRegion = {};
+    VkStridedDeviceAddressRegionKHR callableRegion = {};
+};
+
+// the push constant block of the ray generation shader
+struct TracePushConstants {
+    // launch index 0 traces this pixel of the whole image
+    uint32_t tileOffset[2] = {};
+    uint32_t imageSize[2] = {};
+    // frames already averaged into the accumulation image, 0 discards what it holds
+    uint32_t frameIndex = 0;
+    uint32_t sampleCount = 1;
+    uint32_t progressive = 0;
+};
+
 VkDevice device = VK_NULL_HANDLE;
 VkInstance instance = VK_NULL_HANDLE;
 VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 
 VkQueue queue = VK_NULL_HANDLE;
 VkCommandPool commandPool = VK_NULL_HANDLE;
+uint32_t queueFamilyIndex = 0;
+
+// uploads go through a dedicated transfer queue when the device exposes one
+VkQueue transferQueue = VK_NULL_HANDLE;
+VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+uint32_t transferQueueFamilyIndex = 0;
+
+// TLAS updates run on a compute-only family when available, so the build of the next frame
+// overlaps the trace of the current one
+bool asyncComputeBuilds = false;
+VkQueue computeQueue = VK_NULL_HANDLE;
+VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+uint32_t computeQueueFamilyIndex = 0;
+uint64_t computeTimestampMask = 0;
 
 VkPipeline pipeline = VK_NULL_HANDLE;
 VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+VkPipelineCache pipelineCache = VK_NULL_HANDLE;
 
-VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+// one per top-level acceleration structure
+std::vector<VkDescriptorSet> descriptorSets;
 VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
 VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
 
 VkSurfaceKHR surface = VK_NULL_HANDLE;
 VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+std::vector<VkImage> swapchainImages;
+std::vector<VkImageView> swapchainImageViews;
+
+// frames recorded without presenting, like the headless benchmark, pass this as swapchain image
+const uint32_t noSwapchainImage = 0xFFFFFFFFu;
+
+// with direct presents the swapchain images are traced into through these sets
+std::vector<VkDescriptorSet> presentDescriptorSets;
+VkDescriptorPool presentDescriptorPool = VK_NULL_HANDLE;
+
+// a copy from the staging ring into a device local buffer, waiting to be recorded
+struct StagingCopy {
+    VkBuffer dstBuffer = VK_NULL_HANDLE;
+    VkBufferCopy region = {};
+};
+
+// a timeline semaphore per queue, every submission signals the next value so the CPU can wait
+// for or poll any earlier submission without creating a fence
+struct SubmissionTimeline {
+    VkQueue queue = VK_NULL_HANDLE;
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    uint64_t nextValue = 1;
+    // last value the CPU has seen reached, saves asking the driver again
+    uint64_t completedValue = 0;
+};
+
+// a semaphore a submission waits on, value is ignored for binary semaphores
+struct SubmissionWait {
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    uint64_t value = 0;
+    VkPipelineStageFlags stageMask = 0;
+};
+
+// runs release once the submission that signals value on the timeline has finished
+struct DeferredRelease {
+    SubmissionTimeline* timeline = nullptr;
+    uint64_t value = 0;
+    std::function<void()> release;
+};
+
+// a submitted batch of copies, its range of the ring is reusable once the transfer timeline
+// reached submitValue
+struct StagingBatch {
+    uint64_t submitValue = 0;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkDeviceSize begin = 0;
+    VkDeviceSize end = 0;
+};
+
+struct StagingRing {
+    MappedBuffer buffer;
+    VkDeviceSize size = 0;
+    VkDeviceSize head = 0;
+    VkDeviceSize batchBegin = 0;
+    std::vector<StagingCopy> pendingCopies;
+    std::vector<StagingBatch> batches;
+    uint64_t bytesUploaded = 0;
+    std::chrono::high_resolution_clock::time_point uploadStart;
+};
+
+// a begin/end timestamp pair recorded into one of the profiler query pools
+struct GpuScope {
+    uint32_t scopeIndex = 0;
+    uint32_t queryIndex = 0;
+};
+
+// rolling window of the GPU times measured for one named scope
+struct GpuProfilerScope {
+    std::string name;
+    std::vector<double> samples;
+    uint32_t nextSample = 0;
+};
+
+struct GpuProfilerPool {
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    uint32_t queryCount = 0;
+    std::vector<GpuScope> recordedScopes;
+};
+
+// build and trace timestamps of every frame in flight, used to measure how much of each async
+// TLAS build ran while the previous frame was still tracing
+struct AsyncOverlapStats {
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    uint64_t previousTraceBegin = 0;
+    uint64_t previousTraceEnd = 0;
+    uint64_t buildTicks = 0;
+    uint64_t overlapTicks = 0;
+};
+
+// secondary command buffers recorded by one pool thread, the pool is reset as a whole once the
+// frame that executed them has finished
+struct ThreadCommandPool {
+    VkCommandPool pool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> commandBuffers;
+    uint32_t usedCount = 0;
+};
+
+// a part of a frame that any pool thread can record into its own secondary command buffer,
+// the primary times it under scopeName
+struct RecordJob {
+    const char* scopeName = nullptr;
+    std::function<void(VkCommandBuffer)> record;
+};
 
-VkSemaphore semaphoreImageAvailable = VK_NULL_HANDLE;
-VkSemaphore semaphoreRenderingAvailable = VK_NULL_HANDLE;
+// resources owned by a single frame in flight
+struct FrameResources {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    // records the TLAS update when builds run on the compute queue
+    VkCommandBuffer computeCommandBuffer = VK_NULL_HANDLE;
+    // main timeline value of the frame's last submission, 0 before the first one
+    uint64_t submitValue = 0;
+    // one per pool thread, indexed by the thread index RunParallel hands out
+    std::vector<ThreadCommandPool> threadCommandPools;
+    VkSemaphore semaphoreImageAvailable = VK_NULL_HANDLE;
+    VkSemaphore semaphoreRenderingAvailable = VK_NULL_HANDLE;
+};
+
+std::vector<FrameResources> frames;
+
+// ring slot of the offline render, the tile it traced is copied into its readback buffer
+struct OfflineTileSlot {
+    MappedBuffer readbackBuffer;
+    // main timeline value of the tile's submission
+    uint64_t submitValue = 0;
+    uint32_t tileIndex = 0;
+    bool pending = false;
+};
+
+// submissions to the main, transfer and compute queue, the last one only with async builds
+SubmissionTimeline mainTimeline;
+SubmissionTimeline transferTimeline;
+SubmissionTimeline computeTimeline;
+std::vector<DeferredRelease> deferredReleases;
 
 VkImage offscreenBuffer;
 VkImageView offscreenBufferView;
 VkDeviceMemory offscreenBufferMemory;
 
-MappedBuffer sbtRayGenBuffer;
-MappedBuffer sbtRayHitBuffer;
-MappedBuffer sbtRayMissBuffer;
+// rgba32f running average of all samples traced since the scene last changed
+VkImage accumulationImage;
+VkImageView accumulationImageView;
+VkDeviceMemory accumulationImageMemory;
 
 uint32_t sbtGroupCount = 3;
-uint32_t sbtHandleSize = 0;
-uint32_t sbtHandleAlignment = 0;
-uint32_t sbtHandleSizeAligned = 0;
-uint32_t sbtSize = 0;
 
-VkAccelerationStructureKHR bottomLevelAS = VK_NULL_HANDLE;
-uint64_t bottomLevelASHandle = 0;
+ShaderBindingTable shaderBindingTable;
+
+std::vector<BottomLevelAccelerationStructure> bottomLevelAccelerationStructures;
+
+// one per frame in flight with async compute builds, so the next frame's update never writes
+// the TLAS the current frame traces, otherwise just one
+std::vector<TopLevelAccelerationStructure> topLevelAccelerationStructures;
+std::vector<VkAccelerationStructureInstanceKHR> sceneInstances;
+
+VkPhysicalDeviceMemoryProperties memoryProperties = {};
 
-VkAccelerationStructureKHR topLevelAS = VK_NULL_HANDLE;
-uint64_t topLevelASHandle = 0;
+// one pool per memory type, each pool grows in blocks of at least memoryBlockSize
+MemoryPool memoryPools[VK_MAX_MEMORY_TYPES];
+VkDeviceSize memoryBlockSize = 64 * 1024 * 1024;
+VkDeviceSize memoryBytesReserved = 0;
+VkDeviceSize memoryBytesUsed = 0;
 
 VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties = {};
+VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties = {};
 VkPhysicalDeviceAccelerationStructureFeaturesKHR rayTracingAccelerationFeatures = {};
 
 uint32_t desiredWindowWidth = 640;
 uint32_t desiredWindowHeight = 480;
 VkFormat desiredSurfaceFormat = VK_FORMAT_B8G8R8A8_UNORM;
 
+// "auto" traces straight into the swapchain images when they can be storage images, "copy" always
+// traces into the offscreen buffer and copies it into the swapchain image, "direct" forces the
+// former
+std::string presentPath = "auto";
+bool directPresent = false;
+
+// headless mode traces into the offscreen buffer without a window or swapchain
+bool headless = false;
+uint32_t benchmarkFrameCount = 1000;
+
+// renders the whole image in tiles into this .ppm instead of benchmarking, the offscreen buffer,
+// accumulation image and readback buffers are one tile large whatever the output size
+std::string offlineImagePath;
+uint32_t offlineTileSize = 1024;
+
+// build bottom-level acceleration structures with ALLOW_COMPACTION and compact them afterwards
+bool compactAccelerationStructures = false;
+
+// animate instance transforms and update the TLAS every frame
+bool animateInstances = false;
+// average every frame into the accumulation image with jittered samples until the scene changes
+bool progressiveAccumulation = false;
+// jittered samples per pixel traced by each launch
+uint32_t samplesPerLaunch = 1;
+// a full TLAS rebuild is done every n frames to limit the quality loss of repeated updates
+uint32_t tlasRebuildInterval = 60;
+// measure GPU time of builds, traces and copies with timestamp queries
+bool gpuProfilerEnabled = false;
+uint32_t gpuProfilerMaxQueries = 64;
+uint32_t gpuProfilerWindowSize = 512;
+uint32_t gpuProfilerPrintInterval = 240;
+// one query pool per frame in flight, followed by one for setup work
+std::vector<GpuProfilerPool> gpuProfilerPools;
+std::vector<GpuProfilerScope> gpuProfilerScopes;
+AsyncOverlapStats asyncOverlapStats;
+uint32_t gpuProfilerSetupPool = 0;
+uint64_t timestampMask = 0;
+float timestampPeriod = 1.0f;
+
+// number of frames the CPU may record ahead of the GPU, also the depth of per-frame rings
+uint32_t framesInFlight = 2;
+
+// host visible ring all uploads into device local buffers are staged through
+StagingRing stagingRing;
+VkDeviceSize stagingRingSize = 16 * 1024 * 1024;
+bool useTransferQueue = false;
+// build the TLAS of animated scenes on a dedicated compute queue
+bool useAsyncCompute = false;
+
+// .obj, .gltf or .glb file traced instead of the built-in triangle
+std::string scenePath;
+// parsed scenes are written to <scene>.rtcache and mapped from there on the next launch
+bool sceneCacheEnabled = true;
+
+// serialized bottom-level acceleration structures are restored instead of rebuilt when their
+// geometry is unchanged and the driver accepts the blobs
+bool blasCacheEnabled = true;
+std::string blasCacheFileName = "blas-cache.bin";
+
+// "auto" builds bottom-level acceleration structures on the pool threads when the driver
+// supports accelerationStructureHostCommands, "host" and "device" force either path
+std::string blasBuildMode = "auto";
+bool hostAccelerationStructureBuilds = false;
+
+// scratch memory shared by all device acceleration structure builds
+ScratchPool scratchPool;
+// BLAS builds recorded together may use at most this much scratch, a single larger build still
+// gets all it needs, so the pool grows to the bigger of the two instead of the sum of all builds
+VkDeviceSize scratchBatchBudget = 32 * 1024 * 1024;
+
+// records this many frame jobs on 1, 2, 4, .. threads before the headless benchmark
+uint32_t recordBenchmarkJobCount = 0;
+uint32_t recordBenchmarkIterations = 32;
+
+// renders the scene on the host instead of creating a device, writing the image if a path is given
+bool cpuReference = false;
+std::string cpuReferenceImagePath;
+uint32_t cpuReferenceIterations = 4;
+// casts this many rays against a BVH8 of the scene with every host ray-cast kernel
+uint32_t rayCastBenchmarkRayCount = 0;
+uint32_t rayCastBatchSize = 4096;
+
+// workers for deferred host operations and other parallel host work, 0 means one per core
+ThreadPool threadPool;
+uint32_t workerThreadCount = 0;
+
+// pipeline cache blob stored next to the executable, reused across launches on the same device
+std::string pipelineCacheFileName = "pipeline-cache.bin";
+bool pipelineCacheWarm = false;
+
+#ifdef _WIN32
 HWND window = NULL;
 HINSTANCE windowInstance;
 
@@ -122,18 +482,24 @@ struct MsgInfo {
 };
 
 std::wstring appName = L"VK_KHR_ray_tracing";
+#endif
 
 // clang-format off
 std::vector<const char*> instanceExtensions = {
-    VK_KHR_SURFACE_EXTENSION_NAME,
-    VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
     VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME
 };
+#ifdef _WIN32
+std::vector<const char*> surfaceInstanceExtensions = {
+    VK_KHR_SURFACE_EXTENSION_NAME,
+    VK_KHR_WIN32_SURFACE_EXTENSION_NAME
+};
+#else
+std::vector<const char*> surfaceInstanceExtensions = {};
+#endif
 std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
 };
 std::vector<const char*> deviceExtensions({
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
     VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
     VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,
     VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
@@ -142,9 +508,43 @@ std::vector<const char*> deviceExtensions({
     VK_KHR_SPIRV_1_4_EXTENSION_NAME,
     VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME
 });
+
+// extension entry points, resolved at runtime once the device exists
+namespace ext {
+PFN_vkGetPhysicalDeviceSurfaceSupportKHR vkGetPhysicalDeviceSurfaceSupportKHR = nullptr;
+
+PFN_vkCreateSwapchainKHR vkCreateSwapchainKHR = nullptr;
+PFN_vkGetSwapchainImagesKHR vkGetSwapchainImagesKHR = nullptr;
+
+PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR = nullptr;
+
+PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR = nullptr;
+PFN_vkCreateRayTracingPipelinesKHR vkCreateRayTracingPipelinesKHR = nullptr;
+PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR = nullptr;
+PFN_vkBuildAccelerationStructuresKHR vkBuildAccelerationStructuresKHR = nullptr;
+PFN_vkWriteAccelerationStructuresPropertiesKHR vkWriteAccelerationStructuresPropertiesKHR = nullptr;
+PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR = nullptr;
+PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR = nullptr;
+PFN_vkGetRayTracingShaderGroupHandlesKHR vkGetRayTracingShaderGroupHandlesKHR = nullptr;
+PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR = nullptr;
+PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR = nullptr;
+PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR = nullptr;
+PFN_vkCmdCopyAccelerationStructureToMemoryKHR vkCmdCopyAccelerationStructureToMemoryKHR = nullptr;
+PFN_vkCmdCopyMemoryToAccelerationStructureKHR vkCmdCopyMemoryToAccelerationStructureKHR = nullptr;
+PFN_vkGetDeviceAccelerationStructureCompatibilityKHR vkGetDeviceAccelerationStructureCompatibilityKHR = nullptr;
+
+PFN_vkCreateDeferredOperationKHR vkCreateDeferredOperationKHR = nullptr;
+PFN_vkDestroyDeferredOperationKHR vkDestroyDeferredOperationKHR = nullptr;
+PFN_vkGetDeferredOperationMaxConcurrencyKHR vkGetDeferredOperationMaxConcurrencyKHR = nullptr;
+PFN_vkGetDeferredOperationResultKHR vkGetDeferredOperationResultKHR = nullptr;
+PFN_vkDeferredOperationJoinKHR vkDeferredOperationJoinKHR = nullptr;
+
+PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR = nullptr;
+}  // namespace ext
 // clang-format on
 
 std::string GetExecutablePath() {
+#ifdef _WIN32
     wchar_t path[MAX_PATH + 1];
     DWORD result = GetModuleFileName(NULL, path, sizeof(path) - 1);
     if (result == 0 || result == sizeof(path) - 1)
@@ -154,193 +554,2204 @@ std::string GetExecutablePath() {
     std::wstring ws(path);
     std::string out(ws.begin(), ws.end());
     return out;
+#else
+    char path[PATH_MAX + 1];
+    ssize_t result = readlink("/proc/self/exe", path, PATH_MAX);
+    if (result <= 0)
+        return "";
+    std::string out(path, (size_t)result);
+    return out.substr(0, out.find_last_of('/'));
+#endif
+}
+
+// SPIR-V words either embedded in the binary or mapped from disk, both are 4 byte aligned
+struct ShaderBlob {
+    const uint32_t* code = nullptr;
+    size_t size = 0;
+    MappedFile file;
+};
+
+#ifdef EMBED_SPIRV
+ShaderBlob GetEmbeddedShaderBlob(const uint32_t* code, size_t size) {
+    ShaderBlob out;
+    out.code = code;
+    out.size = size;
+    return out;
+}
+#else
+// mappings start on a page boundary, so the words can be handed to the driver in place
+ShaderBlob LoadShaderBlob(const std::string& path) {
+    ShaderBlob out;
+    if (!OpenMappedFile(path, out.file)) {
+        throw std::runtime_error("Could not open file");
+    }
+    const uint32_t spirvMagic = 0x07230203;
+    out.code = reinterpret_cast<const uint32_t*>(out.file.data);
+    out.size = out.file.size;
+    if (out.size < sizeof(uint32_t) || out.size % sizeof(uint32_t) != 0 ||
+        out.code[0] != spirvMagic) {
+        CloseMappedFile(out.file);
+        throw std::runtime_error("Invalid SPIR-V file " + path);
+    }
+    return out;
+}
+#endif
+
+void ReleaseShaderBlob(ShaderBlob& blob) {
+    CloseMappedFile(blob.file);
+    blob = ShaderBlob();
 }
 
-VkShaderModule CreateShaderModule(std::vector<char>& code) {
+VkShaderModule CreateShaderModule(const ShaderBlob& blob) {
     VkShaderModule shaderModule = VK_NULL_HANDLE;
     VkShaderModuleCreateInfo shaderModuleInfo = {};
     shaderModuleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shaderModuleInfo.codeSize = code.size();
-    shaderModuleInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+    shaderModuleInfo.codeSize = blob.size;
+    shaderModuleInfo.pCode = blob.code;
     ASSERT_VK_RESULT(vkCreateShaderModule(device, &shaderModuleInfo, nullptr, &shaderModule));
     return shaderModule;
 }
 
+// the blob starts with the header defined by VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+struct PipelineCacheHeader {
+    uint32_t headerSize;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+bool IsPipelineCacheCompatible(const std::vector<char>& data,
+                               const VkPhysicalDeviceProperties& deviceProperties) {
+    if (data.size() < sizeof(PipelineCacheHeader)) {
+        return false;
+    }
+    PipelineCacheHeader header = {};
+    memcpy(&header, data.data(), sizeof(PipelineCacheHeader));
+    return header.headerSize >= sizeof(PipelineCacheHeader) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == deviceProperties.vendorID &&
+           header.deviceID == deviceProperties.deviceID &&
+           memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void CreatePipelineCache(const VkPhysicalDeviceProperties& deviceProperties) {
+    std::string path = GetExecutablePath() + "/" + pipelineCacheFileName;
+
+    std::vector<char> data;
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        data.resize((size_t)file.tellg());
+        file.seekg(0);
+        file.read(data.data(), data.size());
+        file.close();
+    }
+
+    // a cache written by another driver or GPU is dropped instead of handed to the driver
+    if (!data.empty() && !IsPipelineCacheCompatible(data, deviceProperties)) {
+        std::cout << "Ignoring incompatible pipeline cache " << path << std::endl;
+        data.clear();
+    }
+    pipelineCacheWarm = !data.empty();
+    if (pipelineCacheWarm) {
+        std::cout << "Loaded pipeline cache " << path << " (" << (data.size() / 1024) << " KiB)"
+                  << std::endl;
+    }
+
+    VkPipelineCacheCreateInfo pipelineCacheInfo = {};
+    pipelineCacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheInfo.initialDataSize = data.size();
+    pipelineCacheInfo.pInitialData = data.data();
+    ASSERT_VK_RESULT(vkCreatePipelineCache(device, &pipelineCacheInfo, nullptr, &pipelineCache));
+}
+
+void DestroyPipelineCache() {
+    size_t dataSize = 0;
+    ASSERT_VK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr));
+    std::vector<char> data(dataSize);
+    ASSERT_VK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()));
+
+    std::string path = GetExecutablePath() + "/" + pipelineCacheFileName;
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (file.is_open()) {
+        file.write(data.data(), dataSize);
+        file.close();
+        std::cout << "Saved pipeline cache " << path << " (" << (dataSize / 1024) << " KiB)"
+                  << std::endl;
+    } else {
+        std::cout << "Failed to write pipeline cache " << path << std::endl;
+    }
+
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+    pipelineCache = VK_NULL_HANDLE;
+}
+
+// joins until the driver reports this thread or the whole operation as done. THREAD_IDLE means
+// there is no parallel work right now although the operation has not completed yet
+void JoinDeferredOperation(VkDeferredOperationKHR operation) {
+    while (true) {
+        const VkResult result = ext::vkDeferredOperationJoinKHR(device, operation);
+        if (result != VK_THREAD_IDLE_KHR) {
+            // errors are reported by vkGetDeferredOperationResultKHR
+            return;
+        }
+        std::this_thread::yield();
+    };
+}
+
+// compiles every create info on its own deferred operation, so the pool threads can work on
+// all variants at once and on several shaders within each of them
+std::vector<VkPipeline> CreateRayTracingPipelines(
+    const std::vector<VkRayTracingPipelineCreateInfoKHR>& pipelineInfos) {
+    const size_t count = pipelineInfos.size();
+    std::vector<VkPipeline> out(count, VK_NULL_HANDLE);
+    std::vector<VkDeferredOperationKHR> operations(count, VK_NULL_HANDLE);
+
+    // one join task per thread the driver can make use of, holding the operation index
+    std::vector<size_t> joinTasks;
+    for (size_t ii = 0; ii < count; ++ii) {
+        ASSERT_VK_RESULT(ext::vkCreateDeferredOperationKHR(device, nullptr, &operations[ii]));
+        const VkResult createResult = ext::vkCreateRayTracingPipelinesKHR(
+            device, operations[ii], pipelineCache, 1, &pipelineInfos[ii], nullptr, &out[ii]);
+        if (createResult == VK_OPERATION_DEFERRED_KHR) {
+            const uint32_t concurrency =
+                std::max(1u, ext::vkGetDeferredOperationMaxConcurrencyKHR(device, operations[ii]));
+            joinTasks.insert(joinTasks.end(), std::min(concurrency, GetThreadCount(threadPool)),
+                             ii);
+        } else if (createResult != VK_OPERATION_NOT_DEFERRED_KHR) {
+            ASSERT_VK_RESULT(createResult);
+        }
+    };
+
+    RunParallel(threadPool, (uint32_t)joinTasks.size(), [&](uint32_t taskIndex, uint32_t) {
+        JoinDeferredOperation(operations[joinTasks[taskIndex]]);
+    });
+
+    for (size_t ii = 0; ii < count; ++ii) {
+        ASSERT_VK_RESULT(ext::vkGetDeferredOperationResultKHR(device, operations[ii]));
+        ext::vkDestroyDeferredOperationKHR(device, operations[ii], nullptr);
+    };
+    return out;
+}
+
 uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-    for (uint32_t ii = 0; ii < memProperties.memoryTypeCount; ++ii) {
+    for (uint32_t ii = 0; ii < memoryProperties.memoryTypeCount; ++ii) {
         if ((typeFilter & (1 << ii)) &&
-            (memProperties.memoryTypes[ii].propertyFlags & properties) == properties) {
+            (memoryProperties.memoryTypes[ii].propertyFlags & properties) == properties) {
             return ii;
         }
     };
     throw std::runtime_error("failed to find suitable memory type!");
 }
 
-uint64_t GetBufferDeviceAddress(VkBuffer buffer) {
-    PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR = nullptr;
-    RESOLVE_VK_DEVICE_PFN(device, vkGetBufferDeviceAddressKHR);
+uint32_t alignTo(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+VkDeviceSize alignTo(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// tries to carve an aligned range out of the block's free list, first fit
+bool AllocateFromBlock(MemoryBlock& block,
+                       VkDeviceSize size,
+                       VkDeviceSize alignment,
+                       VkDeviceSize& outOffset) {
+    for (size_t ii = 0; ii < block.freeRanges.size(); ++ii) {
+        MemoryRange range = block.freeRanges[ii];
+        VkDeviceSize alignedOffset = alignTo(range.offset, alignment);
+        VkDeviceSize padding = alignedOffset - range.offset;
+        if (padding + size > range.size) {
+            continue;
+        }
+        VkDeviceSize tailSize = range.size - padding - size;
 
+        block.freeRanges.erase(block.freeRanges.begin() + ii);
+        if (tailSize > 0) {
+            block.freeRanges.insert(block.freeRanges.begin() + ii,
+                                    {alignedOffset + size, tailSize});
+        }
+        // alignment padding stays in the free list so it can be reused by smaller allocations
+        if (padding > 0) {
+            block.freeRanges.insert(block.freeRanges.begin() + ii, {range.offset, padding});
+        }
+        outOffset = alignedOffset;
+        return true;
+    };
+    return false;
+}
+
+MemoryAllocation AllocateMemory(const VkMemoryRequirements& memoryRequirements,
+                                VkMemoryPropertyFlags properties) {
+    MemoryAllocation out = {};
+    out.memoryTypeIndex = FindMemoryType(memoryRequirements.memoryTypeBits, properties);
+    out.size = memoryRequirements.size;
+
+    MemoryPool& pool = memoryPools[out.memoryTypeIndex];
+
+    VkDeviceSize offset = 0;
+    uint32_t blockIndex = 0;
+    for (; blockIndex < pool.blocks.size(); ++blockIndex) {
+        if (AllocateFromBlock(pool.blocks[blockIndex], memoryRequirements.size,
+                              memoryRequirements.alignment, offset)) {
+            break;
+        }
+    };
+
+    // no block has enough space left, reserve a new one
+    if (blockIndex == pool.blocks.size()) {
+        MemoryBlock block = {};
+        block.size = std::max(memoryBlockSize, memoryRequirements.size);
+
+        // every block may back buffers which are accessed by device address
+        VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo = {};
+        memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+        memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+
+        VkMemoryAllocateInfo memoryAllocateInfo = {};
+        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocateInfo.pNext = &memoryAllocateFlagsInfo;
+        memoryAllocateInfo.allocationSize = block.size;
+        memoryAllocateInfo.memoryTypeIndex = out.memoryTypeIndex;
+        ASSERT_VK_RESULT(vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &block.memory));
+
+        // host visible blocks stay mapped for their whole lifetime
+        const VkMemoryPropertyFlags typeFlags =
+            memoryProperties.memoryTypes[out.memoryTypeIndex].propertyFlags;
+        if (typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            ASSERT_VK_RESULT(
+                vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mappedData));
+        }
+
+        block.freeRanges.push_back({0, block.size});
+        AllocateFromBlock(block, memoryRequirements.size, memoryRequirements.alignment, offset);
+
+        memoryBytesReserved += block.size;
+        pool.blocks.push_back(block);
+    }
+
+    const MemoryBlock& block = pool.blocks[blockIndex];
+    out.memory = block.memory;
+    out.offset = offset;
+    out.blockIndex = blockIndex;
+    if (block.mappedData != nullptr) {
+        out.mappedData = static_cast<uint8_t*>(block.mappedData) + offset;
+    }
+
+    memoryBytesUsed += out.size;
+
+    return out;
+}
+
+void FreeMemory(MemoryAllocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+    MemoryBlock& block = memoryPools[allocation.memoryTypeIndex].blocks[allocation.blockIndex];
+    std::vector<MemoryRange>& ranges = block.freeRanges;
+
+    // insert sorted and merge with the neighbouring ranges
+    size_t index = 0;
+    while (index < ranges.size() && ranges[index].offset < allocation.offset) {
+        ++index;
+    };
+    ranges.insert(ranges.begin() + index, {allocation.offset, allocation.size});
+
+    if (index + 1 < ranges.size() &&
+        ranges[index].offset + ranges[index].size == ranges[index + 1].offset) {
+        ranges[index].size += ranges[index + 1].size;
+        ranges.erase(ranges.begin() + index + 1);
+    }
+    if (index > 0 && ranges[index - 1].offset + ranges[index - 1].size == ranges[index].offset) {
+        ranges[index - 1].size += ranges[index].size;
+        ranges.erase(ranges.begin() + index);
+    }
+
+    memoryBytesUsed -= allocation.size;
+    allocation = {};
+}
+
+void PrintMemoryStats() {
+    uint32_t blockCount = 0;
+    for (uint32_t ii = 0; ii < memoryProperties.memoryTypeCount; ++ii) {
+        blockCount += (uint32_t)memoryPools[ii].blocks.size();
+    };
+    std::cout << "Device memory: " << (memoryBytesUsed / 1024) << " KiB used of "
+              << (memoryBytesReserved / 1024) << " KiB reserved in " << blockCount << " blocks"
+              << std::endl;
+}
+
+uint64_t GetBufferDeviceAddress(VkBuffer buffer) {
     VkBufferDeviceAddressInfoKHR bufferAddressInfo = {};
     bufferAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
     bufferAddressInfo.buffer = buffer;
 
-    return vkGetBufferDeviceAddressKHR(device, &bufferAddressInfo);
+    return ext::vkGetBufferDeviceAddressKHR(device, &bufferAddressInfo);
 }
 
-MappedBuffer CreateMappedBuffer(void* srcData, uint32_t bufferSize, VkBufferUsageFlags usageFlags) {
+// buffers filled on the transfer queue or read by builds on the compute queue are shared between
+// the families instead of transferring ownership
+uint32_t GetSharingQueueFamilies(VkBufferUsageFlags usageFlags, uint32_t outIndices[3]) {
+    uint32_t count = 0;
+    outIndices[count++] = queueFamilyIndex;
+    if ((usageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT) &&
+        transferQueueFamilyIndex != queueFamilyIndex) {
+        outIndices[count++] = transferQueueFamilyIndex;
+    }
+    if (asyncComputeBuilds) {
+        outIndices[count++] = computeQueueFamilyIndex;
+    }
+    return count;
+}
+
+MappedBuffer CreateMappedBuffer(void* srcData,
+                                VkDeviceSize bufferSize,
+                                VkBufferUsageFlags usageFlags) {
     MappedBuffer out = {};
 
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = bufferSize;
     bufferInfo.usage = usageFlags;
+
+    uint32_t queueFamilyIndices[3] = {};
+    const uint32_t queueFamilyCount = GetSharingQueueFamilies(usageFlags, queueFamilyIndices);
+    if (queueFamilyCount > 1) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = queueFamilyCount;
+        bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
     ASSERT_VK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &out.buffer));
 
     VkMemoryRequirements memoryRequirements;
     vkGetBufferMemoryRequirements(device, out.buffer, &memoryRequirements);
 
-    VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo = {};
-    memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-    memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-
-    VkMemoryAllocateInfo memoryAllocateInfo = {};
-    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memoryAllocateInfo.pNext = &memoryAllocateFlagsInfo;
-    memoryAllocateInfo.allocationSize = memoryRequirements.size;
-    memoryAllocateInfo.memoryTypeIndex =
-        FindMemoryType(memoryRequirements.memoryTypeBits,
+    out.allocation =
+        AllocateMemory(memoryRequirements,
                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    ASSERT_VK_RESULT(vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &out.memory));
-
-    ASSERT_VK_RESULT(vkBindBufferMemory(device, out.buffer, out.memory, 0));
+    ASSERT_VK_RESULT(vkBindBufferMemory(device, out.buffer, out.allocation.memory,
+                                        out.allocation.offset));
 
-    out.deviceAddress = GetBufferDeviceAddress(out.buffer);
+    if (usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+        out.deviceAddress = GetBufferDeviceAddress(out.buffer);
+    }
 
-    void* dstData = nullptr;
     if (srcData != nullptr) {
-        ASSERT_VK_RESULT(vkMapMemory(device, out.memory, 0, bufferSize, 0, &dstData));
-        memcpy(dstData, srcData, bufferSize);
-        vkUnmapMemory(device, out.memory);
+        memcpy(out.allocation.mappedData, srcData, bufferSize);
     }
 
     return out;
 }
 
-AccelerationMemory CreateAccelerationBuffer(uint64_t bufferSize, VkBufferUsageFlags usageFlags) {
+AccelerationMemory CreateAccelerationBuffer(
+    uint64_t bufferSize,
+    VkBufferUsageFlags usageFlags,
+    VkDeviceSize minAlignment = 1,
+    VkMemoryPropertyFlags memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
     AccelerationMemory out = {};
 
     VkBufferCreateInfo bufferCreateInfo{};
     bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferCreateInfo.size = bufferSize;
     bufferCreateInfo.usage = usageFlags;
+
+    uint32_t queueFamilyIndices[3] = {};
+    const uint32_t queueFamilyCount = GetSharingQueueFamilies(usageFlags, queueFamilyIndices);
+    if (queueFamilyCount > 1) {
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferCreateInfo.queueFamilyIndexCount = queueFamilyCount;
+        bufferCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
     ASSERT_VK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &out.buffer));
 
     VkMemoryRequirements memoryRequirements{};
     vkGetBufferMemoryRequirements(device, out.buffer, &memoryRequirements);
+    memoryRequirements.alignment = std::max(memoryRequirements.alignment, minAlignment);
 
-    VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo{};
-    memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-    memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-
-    VkMemoryAllocateInfo memoryAllocateInfo = {};
-    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memoryAllocateInfo.pNext = &memoryAllocateFlagsInfo;
-    memoryAllocateInfo.allocationSize = memoryRequirements.size;
-    memoryAllocateInfo.memoryTypeIndex =
-        FindMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    ASSERT_VK_RESULT(vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &out.memory));
-    ASSERT_VK_RESULT(vkBindBufferMemory(device, out.buffer, out.memory, 0));
+    out.allocation = AllocateMemory(memoryRequirements, memoryPropertyFlags);
+    ASSERT_VK_RESULT(vkBindBufferMemory(device, out.buffer, out.allocation.memory,
+                                        out.allocation.offset));
 
-    out.deviceAddress = GetBufferDeviceAddress(out.buffer);
+    if (usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+        out.deviceAddress = GetBufferDeviceAddress(out.buffer);
+    }
 
     return out;
 }
 
-void InsertCommandImageBarrier(VkCommandBuffer commandBuffer,
-                               VkImage image,
-                               VkAccessFlags srcAccessMask,
-                               VkAccessFlags dstAccessMask,
-                               VkImageLayout oldLayout,
-                               VkImageLayout newLayout,
-                               const VkImageSubresourceRange& subresourceRange) {
-    VkImageMemoryBarrier imageMemoryBarrier = {};
-    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    imageMemoryBarrier.srcAccessMask = srcAccessMask;
-    imageMemoryBarrier.dstAccessMask = dstAccessMask;
-    imageMemoryBarrier.oldLayout = oldLayout;
-    imageMemoryBarrier.newLayout = newLayout;
-    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.image = image;
-    imageMemoryBarrier.subresourceRange = subresourceRange;
+void DestroyBuffer(AccelerationMemory& buffer) {
+    vkDestroyBuffer(device, buffer.buffer, nullptr);
+    FreeMemory(buffer.allocation);
+    buffer = {};
+}
 
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1,
-                         &imageMemoryBarrier);
+void CreateSubmissionTimeline(SubmissionTimeline& timeline, VkQueue queue) {
+    VkSemaphoreTypeCreateInfo semaphoreTypeInfo = {};
+    semaphoreTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    semaphoreTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    semaphoreTypeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &semaphoreTypeInfo;
+
+    timeline = {};
+    timeline.queue = queue;
+    ASSERT_VK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline.semaphore));
 }
 
-uint32_t alignTo(uint32_t value, uint32_t alignment) {
-    return (value + alignment - 1) & ~(alignment - 1);
+// submits a single command buffer which signals the next value of the timeline, plus
+// signalSemaphore if given, and returns that value
+uint64_t SubmitTracked(SubmissionTimeline& timeline,
+                       VkCommandBuffer commandBuffer,
+                       const std::vector<SubmissionWait>& waits = {},
+                       VkSemaphore signalSemaphore = VK_NULL_HANDLE) {
+    const uint64_t value = timeline.nextValue++;
+
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<uint64_t> waitValues;
+    std::vector<VkPipelineStageFlags> waitStageMasks;
+    for (const SubmissionWait& wait : waits) {
+        waitSemaphores.push_back(wait.semaphore);
+        waitValues.push_back(wait.value);
+        waitStageMasks.push_back(wait.stageMask);
+    };
+
+    // binary semaphores ignore their entry in the value arrays
+    std::vector<VkSemaphore> signalSemaphores;
+    std::vector<uint64_t> signalValues;
+    if (signalSemaphore != VK_NULL_HANDLE) {
+        signalSemaphores.push_back(signalSemaphore);
+        signalValues.push_back(0);
+    }
+    signalSemaphores.push_back(timeline.semaphore);
+    signalValues.push_back(value);
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = (uint32_t)waitValues.size();
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = (uint32_t)signalValues.size();
+    timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStageMasks.data();
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = (uint32_t)signalSemaphores.size();
+    submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+    ASSERT_VK_RESULT(vkQueueSubmit(timeline.queue, 1, &submitInfo, VK_NULL_HANDLE));
+    return value;
 }
 
-LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
-    MsgInfo info{hWnd, uMsg, wParam, lParam};
-    switch (info.uMsg) {
-        case WM_CLOSE:
-            DestroyWindow(info.hWnd);
-            PostQuitMessage(0);
-            break;
+bool IsSubmissionComplete(SubmissionTimeline& timeline, uint64_t value) {
+    if (value > timeline.completedValue) {
+        ASSERT_VK_RESULT(
+            vkGetSemaphoreCounterValue(device, timeline.semaphore, &timeline.completedValue));
     }
-    return (DefWindowProc(hWnd, uMsg, wParam, lParam));
+    return value <= timeline.completedValue;
 }
 
-bool IsValidationLayerAvailable(const char* layerName) {
-    uint32_t propertyCount = 0;
-    ASSERT_VK_RESULT(vkEnumerateInstanceLayerProperties(&propertyCount, nullptr));
-    std::vector<VkLayerProperties> properties(propertyCount);
-    ASSERT_VK_RESULT(vkEnumerateInstanceLayerProperties(&propertyCount, properties.data()));
-    // loop through all toggled layers and check if we can enable each
-    for (unsigned int ii = 0; ii < properties.size(); ++ii) {
-        if (strcmp(layerName, properties[ii].layerName) == 0) {
-            return true;
+void WaitForSubmission(SubmissionTimeline& timeline, uint64_t value) {
+    if (value <= timeline.completedValue) {
+        return;
+    }
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline.semaphore;
+    waitInfo.pValues = &value;
+    ASSERT_VK_RESULT(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+    timeline.completedValue = value;
+}
+
+// keeps a resource alive until the GPU is done with the submission that signals value
+void ReleaseAfterSubmission(SubmissionTimeline& timeline,
+                            uint64_t value,
+                            const std::function<void()>& release) {
+    DeferredRelease deferredRelease;
+    deferredRelease.timeline = &timeline;
+    deferredRelease.value = value;
+    deferredRelease.release = release;
+    deferredReleases.push_back(deferredRelease);
+}
+
+// releases everything whose submission has finished, or everything at all when waiting
+void CollectDeferredReleases(bool wait) {
+    size_t kept = 0;
+    for (size_t ii = 0; ii < deferredReleases.size(); ++ii) {
+        DeferredRelease& deferredRelease = deferredReleases[ii];
+        if (wait) {
+            WaitForSubmission(*deferredRelease.timeline, deferredRelease.value);
+        }
+        if (IsSubmissionComplete(*deferredRelease.timeline, deferredRelease.value)) {
+            deferredRelease.release();
+        } else {
+            deferredReleases[kept++] = deferredRelease;
         }
     };
-    return false;
+    deferredReleases.resize(kept);
 }
 
-int main() {
-    // clang-format off
-    PFN_vkGetPhysicalDeviceSurfaceSupportKHR vkGetPhysicalDeviceSurfaceSupportKHR = nullptr;
-
-    PFN_vkCreateSwapchainKHR vkCreateSwapchainKHR = nullptr;
-    PFN_vkGetSwapchainImagesKHR vkGetSwapchainImagesKHR = nullptr;
-    
-    PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR = nullptr;
-
-    PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR = nullptr;
-    PFN_vkCreateRayTracingPipelinesKHR vkCreateRayTracingPipelinesKHR = nullptr;
-    PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR = nullptr;
-    PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR = nullptr;
-    PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR = nullptr;
-    PFN_vkGetRayTracingShaderGroupHandlesKHR vkGetRayTracingShaderGroupHandlesKHR = nullptr;
-    PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR = nullptr;
-
-    PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR = nullptr;
-    // clang-format on
+void DestroySubmissionTimelines() {
+    CollectDeferredReleases(true);
+    for (SubmissionTimeline* timeline : {&mainTimeline, &transferTimeline, &computeTimeline}) {
+        if (timeline->semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, timeline->semaphore, nullptr);
+        }
+        *timeline = {};
+    };
+}
 
-    TCHAR dest[MAX_PATH];
-    const DWORD length = GetModuleFileName(nullptr, dest, MAX_PATH);
-    PathCchRemoveFileSpec(dest, MAX_PATH);
+// makes sure the pool holds at least size bytes and returns its aligned base address, a
+// replaced buffer stays alive until the last build that used it has finished
+VkDeviceAddress ReserveScratch(VkDeviceSize size) {
+    if (size <= scratchPool.capacity) {
+        return scratchPool.baseAddress;
+    }
+    if (scratchPool.memory.buffer != VK_NULL_HANDLE) {
+        AccelerationMemory retired = scratchPool.memory;
+        ReleaseAfterSubmission(mainTimeline, scratchPool.lastUseValue,
+                               [retired]() mutable { DestroyBuffer(retired); });
+    }
 
-    std::wstring basePath = std::wstring(dest);
+    const VkDeviceSize alignment =
+        accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment;
+    scratchPool.memory = CreateAccelerationBuffer(
+        size + alignment,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    scratchPool.capacity = size;
+    scratchPool.baseAddress = alignTo(scratchPool.memory.deviceAddress, alignment);
+    return scratchPool.baseAddress;
+}
 
-    windowInstance = GetModuleHandle(0);
+// the GPU must be done with every build
+void DestroyScratchPool() {
+    DestroyBuffer(scratchPool.memory);
+    scratchPool = {};
+}
 
-    WNDCLASSEX wndClass;
-    wndClass.cbSize = sizeof(WNDCLASSEX);
+VkCommandBuffer BeginSingleTimeCommands() {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = commandPool;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = 1;
+
+    ASSERT_VK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer));
+
+    VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+    commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    ASSERT_VK_RESULT(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+
+    return commandBuffer;
+}
+
+// submits the command buffer without waiting, it is freed once the returned value is reached
+uint64_t SubmitSingleTimeCommands(VkCommandBuffer commandBuffer) {
+    ASSERT_VK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+    const uint64_t value = SubmitTracked(mainTimeline, commandBuffer);
+    ReleaseAfterSubmission(mainTimeline, value, [commandBuffer]() {
+        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    });
+    return value;
+}
+
+// submits the command buffer and blocks until the GPU has finished executing it
+void EndSingleTimeCommands(VkCommandBuffer commandBuffer) {
+    WaitForSubmission(mainTimeline, SubmitSingleTimeCommands(commandBuffer));
+    CollectDeferredReleases(false);
+}
+
+void CreateStagingRing() {
+    stagingRing.size = stagingRingSize;
+    stagingRing.buffer =
+        CreateMappedBuffer(nullptr, stagingRing.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+}
+
+void RetireStagingBatch() {
+    StagingBatch& batch = stagingRing.batches.front();
+    WaitForSubmission(transferTimeline, batch.submitValue);
+    vkFreeCommandBuffers(device, transferCommandPool, 1, &batch.commandBuffer);
+    stagingRing.batches.erase(stagingRing.batches.begin());
+}
+
+// records all pending copies into one command buffer and submits it without waiting
+void FlushStagingRing() {
+    if (stagingRing.pendingCopies.empty()) {
+        return;
+    }
+
+    StagingBatch batch = {};
+    batch.begin = stagingRing.batchBegin;
+    batch.end = stagingRing.head;
+
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = transferCommandPool;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = 1;
+    ASSERT_VK_RESULT(
+        vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &batch.commandBuffer));
+
+    VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+    commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    ASSERT_VK_RESULT(vkBeginCommandBuffer(batch.commandBuffer, &commandBufferBeginInfo));
+
+    // consecutive copies into the same buffer are merged into a single copy command
+    std::vector<VkBufferCopy> regions;
+    for (size_t ii = 0; ii < stagingRing.pendingCopies.size(); ++ii) {
+        const StagingCopy& copy = stagingRing.pendingCopies[ii];
+        regions.push_back(copy.region);
+        const bool last = ii + 1 == stagingRing.pendingCopies.size();
+        if (last || stagingRing.pendingCopies[ii + 1].dstBuffer != copy.dstBuffer) {
+            vkCmdCopyBuffer(batch.commandBuffer, stagingRing.buffer.buffer, copy.dstBuffer,
+                            (uint32_t)regions.size(), regions.data());
+            regions.clear();
+        }
+    };
+
+    ASSERT_VK_RESULT(vkEndCommandBuffer(batch.commandBuffer));
+
+    batch.submitValue = SubmitTracked(transferTimeline, batch.commandBuffer);
+
+    stagingRing.batches.push_back(batch);
+    stagingRing.pendingCopies.clear();
+    stagingRing.batchBegin = stagingRing.head;
+}
+
+// reserves space in the ring, waiting only for the batches still reading the requested range
+VkDeviceSize AllocateStagingRange(VkDeviceSize size) {
+    VkDeviceSize offset = alignTo(stagingRing.head, (VkDeviceSize)16);
+    if (offset + size > stagingRing.size) {
+        FlushStagingRing();
+        offset = 0;
+        stagingRing.batchBegin = 0;
+    }
+    // batches retire in submission order, so wait until none of them reads the range anymore
+    while (!stagingRing.batches.empty()) {
+        bool overlaps = false;
+        for (const StagingBatch& batch : stagingRing.batches) {
+            overlaps |= offset < batch.end && batch.begin < offset + size;
+        };
+        if (!overlaps) {
+            break;
+        }
+        RetireStagingBatch();
+    };
+    stagingRing.head = offset + size;
+    return offset;
+}
+
+// copies host data into the ring and queues a GPU copy into dstBuffer, split into chunks
+// when the data is larger than the ring
+void StageUpload(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* srcData,
+                 VkDeviceSize size) {
+    if (stagingRing.pendingCopies.empty() && stagingRing.batches.empty()) {
+        stagingRing.uploadStart = std::chrono::high_resolution_clock::now();
+    }
+
+    const uint8_t* src = static_cast<const uint8_t*>(srcData);
+    VkDeviceSize uploaded = 0;
+    while (uploaded < size) {
+        const VkDeviceSize chunkSize = std::min(size - uploaded, stagingRing.size);
+        const VkDeviceSize offset = AllocateStagingRange(chunkSize);
+        memcpy(static_cast<uint8_t*>(stagingRing.buffer.allocation.mappedData) + offset,
+               src + uploaded, chunkSize);
+
+        StagingCopy copy = {};
+        copy.dstBuffer = dstBuffer;
+        copy.region.srcOffset = offset;
+        copy.region.dstOffset = dstOffset + uploaded;
+        copy.region.size = chunkSize;
+        stagingRing.pendingCopies.push_back(copy);
+
+        uploaded += chunkSize;
+    };
+    stagingRing.bytesUploaded += size;
+}
+
+// submits what is left and blocks until every staged upload has landed in device memory
+void FinishUploads() {
+    FlushStagingRing();
+    if (stagingRing.batches.empty()) {
+        return;
+    }
+    while (!stagingRing.batches.empty()) {
+        RetireStagingBatch();
+    };
+    stagingRing.head = 0;
+    stagingRing.batchBegin = 0;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(end - stagingRing.uploadStart).count();
+    std::cout << "Uploaded " << (stagingRing.bytesUploaded / 1024) << " KiB in "
+              << (seconds * 1000.0) << "ms ("
+              << ((double)stagingRing.bytesUploaded / seconds / (1024.0 * 1024.0)) << " MiB/s)"
+              << std::endl;
+    stagingRing.bytesUploaded = 0;
+}
+
+// creates a device local buffer and stages srcData into it, FinishUploads must be called
+// before the GPU reads from it
+AccelerationMemory CreateDeviceLocalBuffer(const void* srcData,
+                                           uint64_t bufferSize,
+                                           VkBufferUsageFlags usageFlags,
+                                           VkDeviceSize minAlignment = 1) {
+    AccelerationMemory out = CreateAccelerationBuffer(
+        bufferSize, usageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT, minAlignment);
+    StageUpload(out.buffer, 0, srcData, bufferSize);
+    return out;
+}
+
+void CreateGpuProfiler(uint32_t timestampValidBits) {
+    if (!gpuProfilerEnabled) {
+        return;
+    }
+    if (timestampValidBits == 0) {
+        std::cout << "Timestamps are not supported on this queue, profiling disabled" << std::endl;
+        gpuProfilerEnabled = false;
+        return;
+    }
+    timestampMask = timestampValidBits >= 64 ? UINT64_MAX : ((1ull << timestampValidBits) - 1);
+
+    gpuProfilerSetupPool = framesInFlight;
+    gpuProfilerPools.resize(framesInFlight + 1);
+
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = gpuProfilerMaxQueries;
+
+    // queries have to be reset once before their results may be read back
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    for (GpuProfilerPool& pool : gpuProfilerPools) {
+        ASSERT_VK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &pool.queryPool));
+        vkCmdResetQueryPool(commandBuffer, pool.queryPool, 0, gpuProfilerMaxQueries);
+    };
+    EndSingleTimeCommands(commandBuffer);
+}
+
+void DestroyGpuProfiler() {
+    for (GpuProfilerPool& pool : gpuProfilerPools) {
+        vkDestroyQueryPool(device, pool.queryPool, nullptr);
+    };
+    gpuProfilerPools.clear();
+}
+
+// resets the pool, must be recorded before any scope of the command buffer
+void BeginGpuProfilerFrame(VkCommandBuffer commandBuffer, uint32_t poolIndex) {
+    if (!gpuProfilerEnabled) {
+        return;
+    }
+    GpuProfilerPool& pool = gpuProfilerPools[poolIndex];
+    vkCmdResetQueryPool(commandBuffer, pool.queryPool, 0, gpuProfilerMaxQueries);
+    pool.queryCount = 0;
+    pool.recordedScopes.clear();
+}
+
+GpuScope BeginGpuScope(VkCommandBuffer commandBuffer, uint32_t poolIndex, const char* name) {
+    GpuScope out = {};
+    if (!gpuProfilerEnabled) {
+        return out;
+    }
+    GpuProfilerPool& pool = gpuProfilerPools[poolIndex];
+    if (pool.queryCount + 2 > gpuProfilerMaxQueries) {
+        throw std::runtime_error("Too many GPU profiler scopes in a single frame");
+    }
+
+    while (out.scopeIndex < gpuProfilerScopes.size() &&
+           gpuProfilerScopes[out.scopeIndex].name != name) {
+        ++out.scopeIndex;
+    };
+    if (out.scopeIndex == gpuProfilerScopes.size()) {
+        GpuProfilerScope scope = {};
+        scope.name = name;
+        gpuProfilerScopes.push_back(scope);
+    }
+
+    out.queryIndex = pool.queryCount;
+    pool.queryCount += 2;
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool.queryPool,
+                        out.queryIndex);
+    return out;
+}
+
+void EndGpuScope(VkCommandBuffer commandBuffer, uint32_t poolIndex, const GpuScope& scope) {
+    if (!gpuProfilerEnabled) {
+        return;
+    }
+    GpuProfilerPool& pool = gpuProfilerPools[poolIndex];
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool.queryPool,
+                        scope.queryIndex + 1);
+    pool.recordedScopes.push_back(scope);
+}
+
+// reads back the timestamps of the pool once the GPU is done with it, without waiting a pool
+// whose results aren't available yet is skipped
+void ResolveGpuProfilerFrame(uint32_t poolIndex, bool wait) {
+    if (!gpuProfilerEnabled) {
+        return;
+    }
+    GpuProfilerPool& pool = gpuProfilerPools[poolIndex];
+    if (pool.queryCount == 0) {
+        return;
+    }
+
+    std::vector<uint64_t> timestamps(pool.queryCount);
+    VkQueryResultFlags flags = VK_QUERY_RESULT_64_BIT;
+    if (wait) {
+        flags |= VK_QUERY_RESULT_WAIT_BIT;
+    }
+    VkResult result = vkGetQueryPoolResults(device, pool.queryPool, 0, pool.queryCount,
+                                            timestamps.size() * sizeof(uint64_t), timestamps.data(),
+                                            sizeof(uint64_t), flags);
+    if (result != VK_SUCCESS) {
+        return;
+    }
+
+    for (const GpuScope& scope : pool.recordedScopes) {
+        const uint64_t ticks =
+            (timestamps[scope.queryIndex + 1] - timestamps[scope.queryIndex]) & timestampMask;
+        const double milliseconds = (double)ticks * timestampPeriod / 1e6;
+
+        GpuProfilerScope& profilerScope = gpuProfilerScopes[scope.scopeIndex];
+        if (profilerScope.samples.size() < gpuProfilerWindowSize) {
+            profilerScope.samples.push_back(milliseconds);
+        } else {
+            profilerScope.samples[profilerScope.nextSample] = milliseconds;
+        }
+        profilerScope.nextSample = (profilerScope.nextSample + 1) % gpuProfilerWindowSize;
+    };
+}
+
+void PrintGpuProfilerStats() {
+    if (!gpuProfilerEnabled) {
+        return;
+    }
+    std::cout << "GPU times (min / avg / p99):" << std::endl;
+    for (const GpuProfilerScope& scope : gpuProfilerScopes) {
+        if (scope.samples.empty()) {
+            continue;
+        }
+        std::vector<double> sorted = scope.samples;
+        std::sort(sorted.begin(), sorted.end());
+
+        double sum = 0.0;
+        for (double sample : sorted) {
+            sum += sample;
+        };
+        const size_t p99Index = std::min(sorted.size() - 1, (size_t)(sorted.size() * 0.99));
+
+        std::cout << "  " << scope.name << ": " << sorted.front() << "ms / "
+                  << (sum / sorted.size()) << "ms / " << sorted[p99Index] << "ms ("
+                  << sorted.size() << " samples)" << std::endl;
+    };
+}
+
+// the first two queries of a ring slot are written on the compute queue, the last two on the
+// main queue. comparing them assumes both queues share one device clock, which the spec does
+// not promise but desktop drivers provide
+void CreateAsyncOverlapQueries() {
+    if (!gpuProfilerEnabled || !asyncComputeBuilds) {
+        return;
+    }
+    if (computeTimestampMask == 0) {
+        std::cout << "Timestamps are not supported on the compute queue, overlap not measured"
+                  << std::endl;
+        return;
+    }
+
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 4 * framesInFlight;
+    ASSERT_VK_RESULT(
+        vkCreateQueryPool(device, &queryPoolInfo, nullptr, &asyncOverlapStats.queryPool));
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    vkCmdResetQueryPool(commandBuffer, asyncOverlapStats.queryPool, 0, queryPoolInfo.queryCount);
+    EndSingleTimeCommands(commandBuffer);
+}
+
+void DestroyAsyncOverlapQueries() {
+    if (asyncOverlapStats.queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, asyncOverlapStats.queryPool, nullptr);
+    }
+    asyncOverlapStats = {};
+}
+
+// writes a begin or end timestamp of the build (compute queue) or trace (main queue) of a frame
+void WriteAsyncOverlapTimestamp(VkCommandBuffer commandBuffer,
+                                uint32_t ringIndex,
+                                bool trace,
+                                bool end) {
+    if (asyncOverlapStats.queryPool == VK_NULL_HANDLE) {
+        return;
+    }
+    const uint32_t queryIndex = 4 * ringIndex + (trace ? 2 : 0);
+    if (!end) {
+        vkCmdResetQueryPool(commandBuffer, asyncOverlapStats.queryPool, queryIndex, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            asyncOverlapStats.queryPool, queryIndex);
+    } else {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            asyncOverlapStats.queryPool, queryIndex + 1);
+    }
+}
+
+// frames have to be resolved in submission order, each build is compared against the trace
+// of the frame resolved before it
+void ResolveAsyncOverlap(uint32_t ringIndex) {
+    if (asyncOverlapStats.queryPool == VK_NULL_HANDLE) {
+        return;
+    }
+    uint64_t timestamps[4] = {};
+    VkResult queryResult =
+        vkGetQueryPoolResults(device, asyncOverlapStats.queryPool, 4 * ringIndex, 4,
+                              sizeof(timestamps), timestamps, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT);
+    if (queryResult != VK_SUCCESS) {
+        return;
+    }
+
+    const uint64_t buildBegin = timestamps[0] & computeTimestampMask;
+    const uint64_t buildEnd = timestamps[1] & computeTimestampMask;
+    if (asyncOverlapStats.previousTraceEnd != 0 && buildEnd > buildBegin) {
+        const uint64_t overlapBegin = std::max(buildBegin, asyncOverlapStats.previousTraceBegin);
+        const uint64_t overlapEnd = std::min(buildEnd, asyncOverlapStats.previousTraceEnd);
+        asyncOverlapStats.buildTicks += buildEnd - buildBegin;
+        if (overlapEnd > overlapBegin) {
+            asyncOverlapStats.overlapTicks += overlapEnd - overlapBegin;
+        }
+    }
+    asyncOverlapStats.previousTraceBegin = timestamps[2] & timestampMask;
+    asyncOverlapStats.previousTraceEnd = timestamps[3] & timestampMask;
+}
+
+void PrintAsyncOverlapStats() {
+    if (asyncOverlapStats.buildTicks == 0) {
+        return;
+    }
+    const double buildMilliseconds = (double)asyncOverlapStats.buildTicks * timestampPeriod / 1e6;
+    std::cout << "Async TLAS builds: " << buildMilliseconds << "ms, "
+              << (100.0 * asyncOverlapStats.overlapTicks / asyncOverlapStats.buildTicks)
+              << "% overlapped with the previous frame's trace" << std::endl;
+}
+
+// host builds need the acceleration structure in host visible memory
+VkAccelerationStructureKHR CreateAccelerationStructure(
+    VkAccelerationStructureTypeKHR type,
+    VkDeviceSize size,
+    AccelerationMemory& outMemory,
+    VkMemoryPropertyFlags memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+    VkAccelerationStructureKHR out = VK_NULL_HANDLE;
+
+    // reserve memory to hold the acceleration structure
+    outMemory = CreateAccelerationBuffer(size,
+                                         VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+                                             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                         1, memoryPropertyFlags);
+
+    VkAccelerationStructureCreateInfoKHR accelerationStructureInfo = {};
+    accelerationStructureInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+    accelerationStructureInfo.buffer = outMemory.buffer;
+    accelerationStructureInfo.size = size;
+    accelerationStructureInfo.type = type;
+
+    ASSERT_VK_RESULT(
+        ext::vkCreateAccelerationStructureKHR(device, &accelerationStructureInfo, nullptr, &out));
+
+    return out;
+}
+
+// copies each BLAS into a right-sized one using the compacted sizes written into the query
+// pool and releases the original acceleration structures afterwards
+void CompactBottomLevelAccelerationStructures(std::vector<BottomLevelAccelerationStructure>& blases,
+                                              VkQueryPool queryPool) {
+    const uint32_t count = (uint32_t)blases.size();
+
+    std::vector<VkDeviceSize> compactedSizes(count);
+    ASSERT_VK_RESULT(vkGetQueryPoolResults(device, queryPool, 0, count,
+                                           count * sizeof(VkDeviceSize), compactedSizes.data(),
+                                           sizeof(VkDeviceSize),
+                                           VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+    std::vector<BottomLevelAccelerationStructure> compacted(count);
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    BeginGpuProfilerFrame(commandBuffer, gpuProfilerSetupPool);
+    GpuScope compactScope = BeginGpuScope(commandBuffer, gpuProfilerSetupPool, "blas compaction");
+
+    VkDeviceSize sizeBefore = 0;
+    VkDeviceSize sizeAfter = 0;
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        compacted[ii].size = compactedSizes[ii];
+        compacted[ii].handle =
+            CreateAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                                        compacted[ii].size, compacted[ii].memory);
+
+        VkCopyAccelerationStructureInfoKHR copyInfo = {};
+        copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+        copyInfo.src = blases[ii].handle;
+        copyInfo.dst = compacted[ii].handle;
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+        ext::vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+
+        sizeBefore += blases[ii].size;
+        sizeAfter += compacted[ii].size;
+    };
+
+    EndGpuScope(commandBuffer, gpuProfilerSetupPool, compactScope);
+    const uint64_t compactValue = SubmitSingleTimeCommands(commandBuffer);
+    ResolveGpuProfilerFrame(gpuProfilerSetupPool, true);
+
+    // the originals are read by the copies until the submission finishes
+    ReleaseAfterSubmission(mainTimeline, compactValue, [blases]() mutable {
+        for (BottomLevelAccelerationStructure& blas : blases) {
+            ext::vkDestroyAccelerationStructureKHR(device, blas.handle, nullptr);
+            DestroyBuffer(blas.memory);
+        };
+    });
+    blases = compacted;
+
+    std::cout << "Compacted " << count << " BLAS from " << (sizeBefore / 1024) << " KiB to "
+              << (sizeAfter / 1024) << " KiB, saved " << ((sizeBefore - sizeAfter) / 1024)
+              << " KiB" << std::endl;
+}
+
+VkBuildAccelerationStructureFlagsKHR GetBottomLevelBuildFlags() {
+    VkBuildAccelerationStructureFlagsKHR buildFlags =
+        VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    if (compactAccelerationStructures) {
+        buildFlags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+    }
+    return buildFlags;
+}
+
+uint64_t GetAccelerationStructureDeviceAddress(VkAccelerationStructureKHR accelerationStructure) {
+    VkAccelerationStructureDeviceAddressInfoKHR asDeviceAddressInfo = {};
+    asDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+    asDeviceAddressInfo.accelerationStructure = accelerationStructure;
+    return ext::vkGetAccelerationStructureDeviceAddressKHR(device, &asDeviceAddressInfo);
+}
+
+VkAccelerationStructureGeometryKHR GetBottomLevelGeometry(const MeshGeometry& mesh,
+                                                          bool hostAddresses) {
+    VkAccelerationStructureGeometryKHR out = {};
+    out.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    out.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    out.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+    out.geometry.triangles.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+    if (hostAddresses) {
+        out.geometry.triangles.vertexData.hostAddress = mesh.vertexData;
+        out.geometry.triangles.indexData.hostAddress = mesh.indexData;
+    } else {
+        out.geometry.triangles.vertexData.deviceAddress = mesh.vertexBufferAddress;
+        out.geometry.triangles.indexData.deviceAddress = mesh.indexBufferAddress;
+    }
+    out.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+    out.geometry.triangles.maxVertex = mesh.vertexCount - 1;
+    out.geometry.triangles.vertexStride = mesh.vertexStride;
+    out.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
+    return out;
+}
+
+// builds the BLAS of every mesh on the pool threads. meshes are split into one batch per
+// thread, balanced by triangle count, and every batch is built on its own deferred operation.
+// the results live in host visible memory and are copied into device local memory afterwards,
+// compacted if enabled, so tracing does not read them over the bus
+std::vector<BottomLevelAccelerationStructure> BuildBottomLevelAccelerationStructuresOnHost(
+    const std::vector<MeshGeometry>& meshes) {
+    const size_t buildCount = meshes.size();
+
+    std::vector<BottomLevelAccelerationStructure> hostStructures(buildCount);
+    std::vector<VkAccelerationStructureGeometryKHR> asGeometries(buildCount);
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> asBuildGeometryInfos(buildCount);
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> asBuildRangeInfos(buildCount);
+    std::vector<std::vector<uint8_t>> scratchMemory(buildCount);
+
+    const VkMemoryPropertyFlags hostMemoryFlags =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    for (size_t ii = 0; ii < buildCount; ++ii) {
+        asGeometries[ii] = GetBottomLevelGeometry(meshes[ii], true);
+
+        VkAccelerationStructureBuildGeometryInfoKHR& asBuildGeometryInfo =
+            asBuildGeometryInfos[ii];
+        asBuildGeometryInfo.sType =
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+        asBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        asBuildGeometryInfo.flags = GetBottomLevelBuildFlags();
+        asBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        asBuildGeometryInfo.geometryCount = 1;
+        asBuildGeometryInfo.pGeometries = &asGeometries[ii];
+
+        const uint32_t primitiveCount = meshes[ii].indexCount / 3;
+        VkAccelerationStructureBuildSizesInfoKHR asBuildSizesInfo = {};
+        asBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+        ext::vkGetAccelerationStructureBuildSizesKHR(
+            device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR, &asBuildGeometryInfo,
+            &primitiveCount, &asBuildSizesInfo);
+
+        BottomLevelAccelerationStructure& blas = hostStructures[ii];
+        blas.size = asBuildSizesInfo.accelerationStructureSize;
+        blas.handle = CreateAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                                                  blas.size, blas.memory, hostMemoryFlags);
+
+        scratchMemory[ii].resize((size_t)asBuildSizesInfo.buildScratchSize);
+        asBuildGeometryInfo.dstAccelerationStructure = blas.handle;
+        asBuildGeometryInfo.scratchData.hostAddress = scratchMemory[ii].data();
+
+        asBuildRangeInfos[ii].primitiveCount = primitiveCount;
+    };
+
+    // biggest meshes first, each going to the batch with the fewest triangles so far
+    const uint32_t batchCount = (uint32_t)std::min<size_t>(buildCount, GetThreadCount(threadPool));
+    std::vector<size_t> order(buildCount);
+    for (size_t ii = 0; ii < buildCount; ++ii) {
+        order[ii] = ii;
+    };
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return meshes[a].indexCount > meshes[b].indexCount;
+    });
+    std::vector<std::vector<size_t>> batches(batchCount);
+    std::vector<uint64_t> batchTriangles(batchCount, 0);
+    for (size_t meshIndex : order) {
+        const size_t batch =
+            std::min_element(batchTriangles.begin(), batchTriangles.end()) - batchTriangles.begin();
+        batches[batch].push_back(meshIndex);
+        batchTriangles[batch] += meshes[meshIndex].indexCount / 3;
+    };
+
+    std::vector<VkDeferredOperationKHR> operations(batchCount, VK_NULL_HANDLE);
+    std::vector<std::vector<VkAccelerationStructureBuildGeometryInfoKHR>> batchInfos(batchCount);
+    std::vector<std::vector<const VkAccelerationStructureBuildRangeInfoKHR*>> batchRanges(
+        batchCount);
+    std::vector<size_t> joinTasks;
+    for (uint32_t ii = 0; ii < batchCount; ++ii) {
+        for (size_t meshIndex : batches[ii]) {
+            batchInfos[ii].push_back(asBuildGeometryInfos[meshIndex]);
+            batchRanges[ii].push_back(&asBuildRangeInfos[meshIndex]);
+        };
+        ASSERT_VK_RESULT(ext::vkCreateDeferredOperationKHR(device, nullptr, &operations[ii]));
+        const VkResult buildResult = ext::vkBuildAccelerationStructuresKHR(
+            device, operations[ii], (uint32_t)batchInfos[ii].size(), batchInfos[ii].data(),
+            batchRanges[ii].data());
+        if (buildResult == VK_OPERATION_DEFERRED_KHR) {
+            const uint32_t concurrency =
+                std::max(1u, ext::vkGetDeferredOperationMaxConcurrencyKHR(device, operations[ii]));
+            joinTasks.insert(joinTasks.end(), std::min(concurrency, GetThreadCount(threadPool)),
+                             ii);
+        } else if (buildResult != VK_OPERATION_NOT_DEFERRED_KHR) {
+            ASSERT_VK_RESULT(buildResult);
+        }
+    };
+
+    RunParallel(threadPool, (uint32_t)joinTasks.size(), [&](uint32_t taskIndex, uint32_t) {
+        JoinDeferredOperation(operations[joinTasks[taskIndex]]);
+    });
+
+    for (uint32_t ii = 0; ii < batchCount; ++ii) {
+        ASSERT_VK_RESULT(ext::vkGetDeferredOperationResultKHR(device, operations[ii]));
+        ext::vkDestroyDeferredOperationKHR(device, operations[ii], nullptr);
+    };
+
+    std::vector<VkDeviceSize> deviceSizes(buildCount);
+    for (size_t ii = 0; ii < buildCount; ++ii) {
+        deviceSizes[ii] = hostStructures[ii].size;
+    };
+    if (compactAccelerationStructures) {
+        std::vector<VkAccelerationStructureKHR> handles(buildCount);
+        for (size_t ii = 0; ii < buildCount; ++ii) {
+            handles[ii] = hostStructures[ii].handle;
+        };
+        ASSERT_VK_RESULT(ext::vkWriteAccelerationStructuresPropertiesKHR(
+            device, (uint32_t)buildCount, handles.data(),
+            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+            buildCount * sizeof(VkDeviceSize), deviceSizes.data(), sizeof(VkDeviceSize)));
+    }
+
+    std::vector<BottomLevelAccelerationStructure> out(buildCount);
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    BeginGpuProfilerFrame(commandBuffer, gpuProfilerSetupPool);
+    GpuScope copyScope = BeginGpuScope(commandBuffer, gpuProfilerSetupPool, "blas host copy");
+
+    for (size_t ii = 0; ii < buildCount; ++ii) {
+        out[ii].size = deviceSizes[ii];
+        out[ii].handle =
+            CreateAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                                        out[ii].size, out[ii].memory);
+
+        VkCopyAccelerationStructureInfoKHR copyInfo = {};
+        copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+        copyInfo.src = hostStructures[ii].handle;
+        copyInfo.dst = out[ii].handle;
+        copyInfo.mode = compactAccelerationStructures
+                            ? VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR
+                            : VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR;
+        ext::vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+    };
+
+    EndGpuScope(commandBuffer, gpuProfilerSetupPool, copyScope);
+    const uint64_t copyValue = SubmitSingleTimeCommands(commandBuffer);
+    ResolveGpuProfilerFrame(gpuProfilerSetupPool, true);
+
+    ReleaseAfterSubmission(mainTimeline, copyValue, [hostStructures]() mutable {
+        for (BottomLevelAccelerationStructure& blas : hostStructures) {
+            ext::vkDestroyAccelerationStructureKHR(device, blas.handle, nullptr);
+            DestroyBuffer(blas.memory);
+        };
+    });
+    for (size_t ii = 0; ii < buildCount; ++ii) {
+        out[ii].deviceAddress = GetAccelerationStructureDeviceAddress(out[ii].handle);
+    };
+    return out;
+}
+
+// builds one BLAS per mesh, consecutive builds are grouped into batches whose scratch fits the
+// batch budget, each batch is one vkCmdBuildAccelerationStructuresKHR call and all of them
+// reuse the same range of the scratch pool one after another
+std::vector<BottomLevelAccelerationStructure> BuildBottomLevelAccelerationStructures(
+    const std::vector<MeshGeometry>& meshes) {
+    const size_t buildCount = meshes.size();
+
+    std::vector<BottomLevelAccelerationStructure> out(buildCount);
+    if (buildCount == 0) {
+        return out;
+    }
+    if (hostAccelerationStructureBuilds) {
+        return BuildBottomLevelAccelerationStructuresOnHost(meshes);
+    }
+
+    std::vector<VkAccelerationStructureGeometryKHR> asGeometries(buildCount);
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> asBuildGeometryInfos(buildCount);
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> asBuildRangeInfos(buildCount);
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR*> asBuildRangeInfoPointers(buildCount);
+    std::vector<VkDeviceSize> scratchOffsets(buildCount);
+    // builds [batchStarts[ii], batchStarts[ii + 1]) are recorded together
+    std::vector<size_t> batchStarts;
+
+    const VkDeviceSize scratchAlignment =
+        accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment;
+
+    const VkBuildAccelerationStructureFlagsKHR buildFlags = GetBottomLevelBuildFlags();
+
+    VkDeviceSize batchScratchSize = 0;
+    VkDeviceSize maxBatchScratchSize = 0;
+    VkDeviceSize totalScratchSize = 0;
+    for (size_t ii = 0; ii < buildCount; ++ii) {
+        const MeshGeometry& mesh = meshes[ii];
+
+        VkAccelerationStructureGeometryKHR& asGeometryInfo = asGeometries[ii];
+        asGeometryInfo = GetBottomLevelGeometry(mesh, false);
+
+        VkAccelerationStructureBuildGeometryInfoKHR& asBuildGeometryInfo =
+            asBuildGeometryInfos[ii];
+        asBuildGeometryInfo.sType =
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+        asBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        asBuildGeometryInfo.flags = buildFlags;
+        asBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        asBuildGeometryInfo.geometryCount = 1;
+        asBuildGeometryInfo.pGeometries = &asGeometryInfo;
+
+        // aquire size to build acceleration structure
+        const uint32_t primitiveCount = mesh.indexCount / 3;
+        VkAccelerationStructureBuildSizesInfoKHR asBuildSizesInfo = {};
+        asBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+        ext::vkGetAccelerationStructureBuildSizesKHR(
+            device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &asBuildGeometryInfo,
+            &primitiveCount, &asBuildSizesInfo);
+
+        BottomLevelAccelerationStructure& blas = out[ii];
+        blas.size = asBuildSizesInfo.accelerationStructureSize;
+        blas.handle = CreateAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                                                  blas.size, blas.memory);
+
+        asBuildGeometryInfo.dstAccelerationStructure = blas.handle;
+
+        // builds of a batch run concurrently, so each one gets its own aligned slice of the
+        // batch range, a build that doesn't fit anymore starts the next batch
+        const VkDeviceSize buildScratchSize =
+            alignTo(asBuildSizesInfo.buildScratchSize, scratchAlignment);
+        if (batchStarts.empty() || batchScratchSize + buildScratchSize > scratchBatchBudget) {
+            batchStarts.push_back(ii);
+            batchScratchSize = 0;
+        }
+        scratchOffsets[ii] = batchScratchSize;
+        batchScratchSize += buildScratchSize;
+        maxBatchScratchSize = std::max(maxBatchScratchSize, batchScratchSize);
+        totalScratchSize += buildScratchSize;
+
+        VkAccelerationStructureBuildRangeInfoKHR& asBuildRangeInfo = asBuildRangeInfos[ii];
+        asBuildRangeInfo.primitiveCount = primitiveCount;
+        asBuildRangeInfo.primitiveOffset = 0;
+        asBuildRangeInfo.firstVertex = 0;
+        asBuildRangeInfo.transformOffset = 0;
+        asBuildRangeInfoPointers[ii] = &asBuildRangeInfo;
+    };
+
+    batchStarts.push_back(buildCount);
+
+    // only the largest batch has to fit into the pool at once
+    const VkDeviceAddress scratchBaseAddress = ReserveScratch(maxBatchScratchSize);
+    std::cout << "BLAS builds in " << batchStarts.size() - 1 << " batches use "
+              << maxBatchScratchSize / 1024 << "KiB of scratch instead of "
+              << totalScratchSize / 1024 << "KiB" << std::endl;
+
+    for (size_t ii = 0; ii < buildCount; ++ii) {
+        asBuildGeometryInfos[ii].scratchData.deviceAddress =
+            scratchBaseAddress + scratchOffsets[ii];
+    };
+
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (compactAccelerationStructures) {
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+        queryPoolInfo.queryCount = (uint32_t)buildCount;
+        ASSERT_VK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool));
+    }
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    BeginGpuProfilerFrame(commandBuffer, gpuProfilerSetupPool);
+
+    GpuScope buildScope = BeginGpuScope(commandBuffer, gpuProfilerSetupPool, "blas build");
+    for (size_t batch = 0; batch + 1 < batchStarts.size(); ++batch) {
+        const size_t first = batchStarts[batch];
+        const size_t count = batchStarts[batch + 1] - first;
+
+        // the previous batch must be done with the scratch range before it is reused
+        if (batch > 0) {
+            VkMemoryBarrier memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                                          VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1,
+                                 &memoryBarrier, 0, nullptr, 0, nullptr);
+        }
+
+        ext::vkCmdBuildAccelerationStructuresKHR(commandBuffer, (uint32_t)count,
+                                                 &asBuildGeometryInfos[first],
+                                                 &asBuildRangeInfoPointers[first]);
+    };
+    EndGpuScope(commandBuffer, gpuProfilerSetupPool, buildScope);
+
+    if (compactAccelerationStructures) {
+        // the compacted size can only be queried once the builds have finished writing
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                             VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1,
+                             &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        std::vector<VkAccelerationStructureKHR> handles(buildCount);
+        for (size_t ii = 0; ii < buildCount; ++ii) {
+            handles[ii] = out[ii].handle;
+        };
+
+        vkCmdResetQueryPool(commandBuffer, queryPool, 0, (uint32_t)buildCount);
+        ext::vkCmdWriteAccelerationStructuresPropertiesKHR(
+            commandBuffer, (uint32_t)buildCount, handles.data(),
+            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+    }
+
+    const uint64_t buildValue = SubmitSingleTimeCommands(commandBuffer);
+    ResolveGpuProfilerFrame(gpuProfilerSetupPool, true);
+
+    scratchPool.lastUseValue = buildValue;
+
+    if (compactAccelerationStructures) {
+        CompactBottomLevelAccelerationStructures(out, queryPool);
+        vkDestroyQueryPool(device, queryPool, nullptr);
+    }
+
+    // get bottom level acceleration structure handles for use in top level instances
+    for (size_t ii = 0; ii < buildCount; ++ii) {
+        out[ii].deviceAddress = GetAccelerationStructureDeviceAddress(out[ii].handle);
+    };
+
+    return out;
+}
+
+// serialized BLAS blobs keyed by a hash of their geometry and build flags, laid out as the
+// header, the entry table and then the blobs as returned by the driver
+const uint32_t blasCacheMagic = 0x43534142;  // "BASC"
+const uint32_t blasCacheVersion = 1;
+// device addresses handed to (de)serialization must be aligned to 256 bytes
+const VkDeviceSize serializedBlasAlignment = 256;
+// driver UUID, compatibility UUID, serialized size, deserialized size and handle count
+const VkDeviceSize serializedBlasHeaderSize = 2 * VK_UUID_SIZE + 3 * sizeof(uint64_t);
+
+struct BlasCacheHeader {
+    uint32_t magic = blasCacheMagic;
+    uint32_t version = blasCacheVersion;
+    uint64_t entryCount = 0;
+};
+
+struct BlasCacheEntry {
+    uint64_t key = 0;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    size_t ii = 0;
+    // whole words first, meshes can be hundreds of MiB
+    for (; ii + sizeof(uint64_t) <= size; ii += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + ii, sizeof(uint64_t));
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 29;
+    };
+    for (; ii < size; ++ii) {
+        hash = (hash ^ bytes[ii]) * 1099511628211ull;
+    };
+    return hash;
+}
+
+uint64_t GetBlasCacheKey(const Scene& scene, const SceneMesh& mesh) {
+    const uint32_t layout[] = {(uint32_t)GetBottomLevelBuildFlags(), mesh.vertexCount,
+                               mesh.indexCount, blasCacheVersion};
+    uint64_t key = HashBytes(layout, sizeof(layout), 14695981039346656037ull);
+    key = HashBytes(scene.positions + (size_t)mesh.firstVertex * 3,
+                    sizeof(Vertex) * mesh.vertexCount, key);
+    key = HashBytes(scene.indices + mesh.firstIndex, sizeof(uint32_t) * mesh.indexCount, key);
+    return key;
+}
+
+// restores every BLAS whose key is in the cache and whose blob the driver accepts, the others
+// are left without a handle so the caller can build them. returns the number restored
+uint32_t LoadBlasCache(const std::string& path,
+                       const std::vector<uint64_t>& keys,
+                       std::vector<BottomLevelAccelerationStructure>& out) {
+    out.assign(keys.size(), BottomLevelAccelerationStructure());
+
+    uint64_t fileSize = 0;
+    int64_t modifiedTime = 0;
+    MappedFile file;
+    if (!GetFileInfo(path, fileSize, modifiedTime) || !OpenMappedFile(path, file)) {
+        return 0;
+    }
+
+    BlasCacheHeader header = {};
+    std::vector<BlasCacheEntry> entries;
+    if (file.size >= sizeof(BlasCacheHeader)) {
+        memcpy(&header, file.data, sizeof(BlasCacheHeader));
+    }
+    if (header.magic == blasCacheMagic && header.version == blasCacheVersion &&
+        header.entryCount <= (file.size - sizeof(BlasCacheHeader)) / sizeof(BlasCacheEntry)) {
+        entries.resize((size_t)header.entryCount);
+        memcpy(entries.data(), file.data + sizeof(BlasCacheHeader),
+               entries.size() * sizeof(BlasCacheEntry));
+    }
+
+    // the driver decides whether a blob written by this or another driver can be deserialized
+    std::vector<const BlasCacheEntry*> hits(keys.size(), nullptr);
+    std::vector<VkDeviceSize> uploadOffsets(keys.size(), 0);
+    VkDeviceSize uploadSize = 0;
+    uint32_t hitCount = 0;
+    for (size_t ii = 0; ii < keys.size(); ++ii) {
+        for (const BlasCacheEntry& entry : entries) {
+            if (entry.key != keys[ii] || entry.offset > file.size ||
+                entry.size > file.size - entry.offset || entry.size < serializedBlasHeaderSize) {
+                continue;
+            }
+            VkAccelerationStructureVersionInfoKHR versionInfo = {};
+            versionInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+            versionInfo.pVersionData = file.data + entry.offset;
+            VkAccelerationStructureCompatibilityKHR compatibility =
+                VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+            ext::vkGetDeviceAccelerationStructureCompatibilityKHR(device, &versionInfo,
+                                                                  &compatibility);
+            if (compatibility == VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+                hits[ii] = &entry;
+                uploadOffsets[ii] = uploadSize;
+                uploadSize += alignTo(entry.size, serializedBlasAlignment);
+                ++hitCount;
+            }
+            break;
+        };
+    };
+    if (hitCount == 0) {
+        if (!entries.empty()) {
+            std::cout << "BLAS cache " << path << " is stale or incompatible" << std::endl;
+        }
+        CloseMappedFile(file);
+        return 0;
+    }
+
+    // blobs are staged straight from the mapping into one device local buffer
+    AccelerationMemory serializedMemory = CreateAccelerationBuffer(
+        uploadSize,
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        serializedBlasAlignment);
+    for (size_t ii = 0; ii < keys.size(); ++ii) {
+        if (hits[ii] != nullptr) {
+            StageUpload(serializedMemory.buffer, uploadOffsets[ii], file.data + hits[ii]->offset,
+                        hits[ii]->size);
+        }
+    };
+    FinishUploads();
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    BeginGpuProfilerFrame(commandBuffer, gpuProfilerSetupPool);
+    GpuScope deserializeScope =
+        BeginGpuScope(commandBuffer, gpuProfilerSetupPool, "blas deserialize");
+
+    for (size_t ii = 0; ii < keys.size(); ++ii) {
+        if (hits[ii] == nullptr) {
+            continue;
+        }
+        // the deserialized size follows the UUIDs and the serialized size
+        uint64_t deserializedSize = 0;
+        memcpy(&deserializedSize, file.data + hits[ii]->offset + 2 * VK_UUID_SIZE + 8,
+               sizeof(uint64_t));
+
+        out[ii].size = deserializedSize;
+        out[ii].handle =
+            CreateAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                                        out[ii].size, out[ii].memory);
+
+        VkCopyMemoryToAccelerationStructureInfoKHR copyInfo = {};
+        copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+        copyInfo.src.deviceAddress = serializedMemory.deviceAddress + uploadOffsets[ii];
+        copyInfo.dst = out[ii].handle;
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+        ext::vkCmdCopyMemoryToAccelerationStructureKHR(commandBuffer, &copyInfo);
+    };
+
+    EndGpuScope(commandBuffer, gpuProfilerSetupPool, deserializeScope);
+    EndSingleTimeCommands(commandBuffer);
+    ResolveGpuProfilerFrame(gpuProfilerSetupPool, true);
+
+    DestroyBuffer(serializedMemory);
+    CloseMappedFile(file);
+
+    for (size_t ii = 0; ii < keys.size(); ++ii) {
+        if (out[ii].handle == VK_NULL_HANDLE) {
+            continue;
+        }
+        out[ii].deviceAddress = GetAccelerationStructureDeviceAddress(out[ii].handle);
+    };
+    return hitCount;
+}
+
+// serializes all BLAS into host memory and replaces the cache file with them
+void SaveBlasCache(const std::string& path,
+                   const std::vector<uint64_t>& keys,
+                   const std::vector<BottomLevelAccelerationStructure>& blases) {
+    const uint32_t count = (uint32_t)blases.size();
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<VkAccelerationStructureKHR> handles(count);
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        handles[ii] = blases[ii].handle;
+    };
+
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+    queryPoolInfo.queryCount = count;
+    ASSERT_VK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool));
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+    // the builds and compaction copies were submitted without waiting, their writes must be done
+    // before the size query and the serialize copies submitted after it
+    VkMemoryBarrier buildBarrier = {};
+    buildBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    buildBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    buildBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1,
+                         &buildBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdResetQueryPool(commandBuffer, queryPool, 0, count);
+    ext::vkCmdWriteAccelerationStructuresPropertiesKHR(
+        commandBuffer, count, handles.data(),
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, queryPool, 0);
+    EndSingleTimeCommands(commandBuffer);
+
+    std::vector<VkDeviceSize> serializedSizes(count);
+    ASSERT_VK_RESULT(vkGetQueryPoolResults(device, queryPool, 0, count,
+                                           count * sizeof(VkDeviceSize), serializedSizes.data(),
+                                           sizeof(VkDeviceSize),
+                                           VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    vkDestroyQueryPool(device, queryPool, nullptr);
+
+    std::vector<VkDeviceSize> offsets(count);
+    VkDeviceSize totalSize = 0;
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        offsets[ii] = totalSize;
+        totalSize += alignTo(serializedSizes[ii], serializedBlasAlignment);
+    };
+
+    // host visible so the blobs can be written out directly, the base address is aligned by hand
+    MappedBuffer serializedMemory = CreateMappedBuffer(
+        nullptr, totalSize + serializedBlasAlignment,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    const VkDeviceAddress baseAddress =
+        alignTo(serializedMemory.deviceAddress, serializedBlasAlignment);
+    const uint8_t* hostBase =
+        static_cast<const uint8_t*>(serializedMemory.allocation.mappedData) +
+        (baseAddress - serializedMemory.deviceAddress);
+
+    commandBuffer = BeginSingleTimeCommands();
+    BeginGpuProfilerFrame(commandBuffer, gpuProfilerSetupPool);
+    GpuScope serializeScope = BeginGpuScope(commandBuffer, gpuProfilerSetupPool, "blas serialize");
+
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        VkCopyAccelerationStructureToMemoryInfoKHR copyInfo = {};
+        copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+        copyInfo.src = handles[ii];
+        copyInfo.dst.deviceAddress = baseAddress + offsets[ii];
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+        ext::vkCmdCopyAccelerationStructureToMemoryKHR(commandBuffer, &copyInfo);
+    };
+
+    // make the serialized data visible to the host
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    EndGpuScope(commandBuffer, gpuProfilerSetupPool, serializeScope);
+    EndSingleTimeCommands(commandBuffer);
+    ResolveGpuProfilerFrame(gpuProfilerSetupPool, true);
+
+    BlasCacheHeader header = {};
+    header.entryCount = count;
+    std::vector<BlasCacheEntry> entries(count);
+    uint64_t fileOffset = sizeof(BlasCacheHeader) + sizeof(BlasCacheEntry) * count;
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        entries[ii].key = keys[ii];
+        entries[ii].offset = fileOffset;
+        entries[ii].size = serializedSizes[ii];
+        fileOffset += serializedSizes[ii];
+    };
+
+    // written to a temporary file first so an interrupted write never leaves a truncated cache
+    const std::string tempPath = path + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(BlasCacheHeader));
+    file.write(reinterpret_cast<const char*>(entries.data()), sizeof(BlasCacheEntry) * count);
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        file.write(reinterpret_cast<const char*>(hostBase + offsets[ii]),
+                   (std::streamsize)serializedSizes[ii]);
+    };
+    file.close();
+    DestroyBuffer(serializedMemory);
+
+    // the previous cache is only dropped once the new one is complete, rename does not replace
+    // an existing file on Windows
+    bool written = static_cast<bool>(file);
+    if (written) {
+        std::remove(path.c_str());
+        written = std::rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+    if (!written) {
+        std::cout << "Failed to write BLAS cache " << path << std::endl;
+        std::remove(tempPath.c_str());
+        return;
+    }
+    std::cout << "Saved BLAS cache " << path << " (" << (fileOffset / 1024) << " KiB)"
+              << std::endl;
+}
+
+void FillTopLevelBuildInfo(const TopLevelAccelerationStructure& tlas,
+                           uint32_t ringIndex,
+                           VkAccelerationStructureGeometryKHR& outGeometry,
+                           VkAccelerationStructureBuildGeometryInfoKHR& outBuildInfo) {
+    outGeometry = {};
+    outGeometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    outGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    outGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    outGeometry.geometry.instances.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+    outGeometry.geometry.instances.arrayOfPointers = VK_FALSE;
+    outGeometry.geometry.instances.data.deviceAddress =
+        tlas.instanceBuffers[ringIndex].deviceAddress;
+
+    outBuildInfo = {};
+    outBuildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    outBuildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    outBuildInfo.flags = tlas.flags;
+    outBuildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    outBuildInfo.geometryCount = 1;
+    outBuildInfo.pGeometries = &outGeometry;
+}
+
+// records a TLAS rebuild or in-place update from the instance buffer of the given ring slot
+void RecordTopLevelBuild(VkCommandBuffer commandBuffer,
+                         TopLevelAccelerationStructure& tlas,
+                         uint32_t ringIndex,
+                         VkBuildAccelerationStructureModeKHR mode) {
+    VkAccelerationStructureGeometryKHR asGeometryInfo = {};
+    VkAccelerationStructureBuildGeometryInfoKHR asBuildGeometryInfo = {};
+    FillTopLevelBuildInfo(tlas, ringIndex, asGeometryInfo, asBuildGeometryInfo);
+    asBuildGeometryInfo.mode = mode;
+    asBuildGeometryInfo.srcAccelerationStructure =
+        mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR ? tlas.handle : VK_NULL_HANDLE;
+    asBuildGeometryInfo.dstAccelerationStructure = tlas.handle;
+    // every TLAS build is ordered behind the previous one by the barrier below, so all of them
+    // share the start of the pool, reserved when the TLAS was created
+    asBuildGeometryInfo.scratchData.deviceAddress = scratchPool.baseAddress;
+
+    VkAccelerationStructureBuildRangeInfoKHR asBuildRangeInfo = {};
+    asBuildRangeInfo.primitiveCount = tlas.instanceCount;
+    VkAccelerationStructureBuildRangeInfoKHR* asBuildRangeInfos[] = {&asBuildRangeInfo};
+
+    // previous traces must be done reading the TLAS and previous builds done with the scratch
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                                  VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                             VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1,
+                         &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    ext::vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &asBuildGeometryInfo,
+                                             asBuildRangeInfos);
+
+    // make the new TLAS visible to the trace
+    memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &memoryBarrier, 0,
+                         nullptr, 0, nullptr);
+}
+
+TopLevelAccelerationStructure& GetFrameTopLevelAccelerationStructure(uint32_t ringIndex) {
+    return topLevelAccelerationStructures[ringIndex % topLevelAccelerationStructures.size()];
+}
+
+// every TLAS of the ring is rebuilt once per interval and updated in place otherwise
+VkBuildAccelerationStructureModeKHR GetTopLevelBuildMode(uint32_t frameIndex) {
+    return frameIndex % tlasRebuildInterval < (uint32_t)topLevelAccelerationStructures.size()
+               ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR
+               : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+}
+
+// creates and initially builds the TLAS, a dynamic TLAS gets one instance buffer per frame in
+// flight so it can be updated inside the frame command buffers
+void CreateTopLevelAccelerationStructure(
+    TopLevelAccelerationStructure& tlas,
+    const std::vector<VkAccelerationStructureInstanceKHR>& instances,
+    bool dynamic) {
+    tlas.instanceCount = (uint32_t)instances.size();
+    tlas.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    if (dynamic) {
+        tlas.flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+    }
+
+    const uint32_t ringSize = dynamic ? framesInFlight : 1;
+    const uint32_t instanceBufferSize =
+        sizeof(VkAccelerationStructureInstanceKHR) * tlas.instanceCount;
+    const VkBufferUsageFlags instanceBufferUsage =
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+    tlas.instanceBuffers.resize(ringSize);
+    // dynamic instances are rewritten by the CPU every frame, so only those stay host visible
+    for (uint32_t ii = 0; ii < ringSize; ++ii) {
+        if (dynamic) {
+            tlas.instanceBuffers[ii] = CreateMappedBuffer((void*)instances.data(),
+                                                          instanceBufferSize, instanceBufferUsage);
+        } else {
+            tlas.instanceBuffers[ii] = CreateDeviceLocalBuffer(
+                instances.data(), instanceBufferSize, instanceBufferUsage);
+        }
+    };
+    FinishUploads();
+
+    VkAccelerationStructureGeometryKHR asGeometryInfo = {};
+    VkAccelerationStructureBuildGeometryInfoKHR asBuildSizeGeometryInfo = {};
+    FillTopLevelBuildInfo(tlas, 0, asGeometryInfo, asBuildSizeGeometryInfo);
+
+    // aquire size to build acceleration structure
+    VkAccelerationStructureBuildSizesInfoKHR asBuildSizesInfo = {};
+    asBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+    ext::vkGetAccelerationStructureBuildSizesKHR(
+        device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &asBuildSizeGeometryInfo,
+        &tlas.instanceCount, &asBuildSizesInfo);
+
+    tlas.size = asBuildSizesInfo.accelerationStructureSize;
+    tlas.handle = CreateAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+                                              tlas.size, tlas.memory);
+
+    // reserve scratch for the initial build as well as later rebuilds and updates
+    tlas.scratchSize =
+        std::max(asBuildSizesInfo.buildScratchSize, asBuildSizesInfo.updateScratchSize);
+    ReserveScratch(tlas.scratchSize);
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    BeginGpuProfilerFrame(commandBuffer, gpuProfilerSetupPool);
+
+    // build the top-level acceleration structure
+    GpuScope buildScope = BeginGpuScope(commandBuffer, gpuProfilerSetupPool, "tlas build");
+    RecordTopLevelBuild(commandBuffer, tlas, 0, VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+    EndGpuScope(commandBuffer, gpuProfilerSetupPool, buildScope);
+
+    const uint64_t buildValue = SubmitSingleTimeCommands(commandBuffer);
+    ResolveGpuProfilerFrame(gpuProfilerSetupPool, true);
+    scratchPool.lastUseValue = buildValue;
+
+    // a static TLAS never gets rebuilt, so its instances are released once the build is done
+    if (!dynamic) {
+        std::vector<MappedBuffer> instanceBuffers = tlas.instanceBuffers;
+        ReleaseAfterSubmission(mainTimeline, buildValue, [instanceBuffers]() mutable {
+            for (MappedBuffer& buffer : instanceBuffers) {
+                DestroyBuffer(buffer);
+            };
+        });
+        tlas.instanceBuffers.clear();
+    }
+
+    // Get top level acceleration structure handle
+    VkAccelerationStructureDeviceAddressInfoKHR deviceAddressInfo = {};
+    deviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+    deviceAddressInfo.accelerationStructure = tlas.handle;
+    tlas.deviceAddress =
+        ext::vkGetAccelerationStructureDeviceAddressKHR(device, &deviceAddressInfo);
+}
+
+// the GPU must be done with every frame that traced or updated them
+void DestroyTopLevelAccelerationStructures() {
+    for (TopLevelAccelerationStructure& tlas : topLevelAccelerationStructures) {
+        ext::vkDestroyAccelerationStructureKHR(device, tlas.handle, nullptr);
+        DestroyBuffer(tlas.memory);
+        for (MappedBuffer& instanceBuffer : tlas.instanceBuffers) {
+            DestroyBuffer(instanceBuffer);
+        };
+    };
+    topLevelAccelerationStructures.clear();
+}
+
+// spins every instance around the y axis, written into the instance buffer of the ring slot
+void WriteAnimatedInstances(TopLevelAccelerationStructure& tlas,
+                            uint32_t ringIndex,
+                            uint32_t frameIndex) {
+    VkAccelerationStructureInstanceKHR* dstInstances =
+        static_cast<VkAccelerationStructureInstanceKHR*>(
+            tlas.instanceBuffers[ringIndex].allocation.mappedData);
+
+    const float angle = (float)frameIndex * 0.02f;
+    const float c = std::cos(angle);
+    const float s = std::sin(angle);
+
+    for (uint32_t ii = 0; ii < tlas.instanceCount; ++ii) {
+        VkAccelerationStructureInstanceKHR instance = sceneInstances[ii];
+        const VkTransformMatrixKHR& src = sceneInstances[ii].transform;
+        for (uint32_t col = 0; col < 4; ++col) {
+            const float x = src.matrix[0][col];
+            const float z = src.matrix[2][col];
+            instance.transform.matrix[0][col] = c * x + s * z;
+            instance.transform.matrix[2][col] = -s * x + c * z;
+        };
+        dstInstances[ii] = instance;
+    };
+}
+
+// every record of a region shares one stride, large enough for the biggest inline data
+VkDeviceSize GetShaderRecordStride(const std::vector<ShaderRecord>& records) {
+    const uint32_t handleSize = rayTracingPipelineProperties.shaderGroupHandleSize;
+    const uint32_t handleAlignment = rayTracingPipelineProperties.shaderGroupHandleAlignment;
+
+    VkDeviceSize dataSize = 0;
+    for (const ShaderRecord& record : records) {
+        dataSize = std::max(dataSize, (VkDeviceSize)record.data.size());
+    };
+    VkDeviceSize stride = alignTo(handleSize + dataSize, (VkDeviceSize)handleAlignment);
+    if (stride > rayTracingPipelineProperties.maxShaderGroupStride) {
+        throw std::runtime_error("Shader record exceeds maxShaderGroupStride");
+    }
+    return stride;
+}
+
+void WriteShaderRecords(std::vector<uint8_t>& table,
+                        VkDeviceSize offset,
+                        VkDeviceSize stride,
+                        const std::vector<ShaderRecord>& records,
+                        const std::vector<uint8_t>& groupHandles) {
+    const uint32_t handleSize = rayTracingPipelineProperties.shaderGroupHandleSize;
+
+    for (size_t ii = 0; ii < records.size(); ++ii) {
+        uint8_t* dst = table.data() + offset + ii * stride;
+        memcpy(dst, groupHandles.data() + records[ii].groupIndex * handleSize, handleSize);
+        if (!records[ii].data.empty()) {
+            memcpy(dst + handleSize, records[ii].data.data(), records[ii].data.size());
+        }
+    };
+}
+
+// packs the records of all stages into one device local buffer, each region starting at
+// shaderGroupBaseAlignment so the regions can be passed directly to vkCmdTraceRaysKHR
+ShaderBindingTable CreateShaderBindingTable(const ShaderRecord& rayGenRecord,
+                                            const std::vector<ShaderRecord>& missRecords,
+                                            const std::vector<ShaderRecord>& hitRecords,
+                                            const std::vector<ShaderRecord>& callableRecords) {
+    ShaderBindingTable out = {};
+
+    const uint32_t handleSize = rayTracingPipelineProperties.shaderGroupHandleSize;
+    const VkDeviceSize baseAlignment = rayTracingPipelineProperties.shaderGroupBaseAlignment;
+
+    std::vector<uint8_t> groupHandles(sbtGroupCount * handleSize);
+    ASSERT_VK_RESULT(ext::vkGetRayTracingShaderGroupHandlesKHR(
+        device, pipeline, 0, sbtGroupCount, groupHandles.size(), groupHandles.data()));
+
+    const std::vector<ShaderRecord> rayGenRecords = {rayGenRecord};
+    const std::vector<ShaderRecord>* regionRecords[] = {&rayGenRecords, &missRecords, &hitRecords,
+                                                        &callableRecords};
+    VkStridedDeviceAddressRegionKHR* regions[] = {&out.rayGenRegion, &out.missRegion,
+                                                  &out.hitRegion, &out.callableRegion};
+
+    // lay out the regions first, device addresses are patched in after the upload
+    VkDeviceSize regionOffsets[4] = {};
+    VkDeviceSize tableSize = 0;
+    for (uint32_t ii = 0; ii < 4; ++ii) {
+        if (regionRecords[ii]->empty()) {
+            continue;
+        }
+        regionOffsets[ii] = alignTo(tableSize, baseAlignment);
+        regions[ii]->stride = GetShaderRecordStride(*regionRecords[ii]);
+        regions[ii]->size = regions[ii]->stride * regionRecords[ii]->size();
+        tableSize = regionOffsets[ii] + regions[ii]->size;
+    };
+
+    std::vector<uint8_t> table(tableSize);
+    for (uint32_t ii = 0; ii < 4; ++ii) {
+        WriteShaderRecords(table, regionOffsets[ii], regions[ii]->stride, *regionRecords[ii],
+                           groupHandles);
+    };
+
+    out.memory = CreateDeviceLocalBuffer(
+        table.data(), tableSize,
+        VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        baseAlignment);
+    FinishUploads();
+
+    for (uint32_t ii = 0; ii < 4; ++ii) {
+        if (!regionRecords[ii]->empty()) {
+            regions[ii]->deviceAddress = out.memory.deviceAddress + regionOffsets[ii];
+        }
+    };
+
+    std::cout << "Shader binding table: " << missRecords.size() << " miss, " << hitRecords.size()
+              << " hit and " << callableRecords.size() << " callable records in " << tableSize
+              << " bytes" << std::endl;
+
+    return out;
+}
+
+// device local image the ray generation shader writes, usage is added to STORAGE
+void CreateStorageImage(VkFormat format,
+                        VkImageUsageFlags usage,
+                        VkExtent2D extent,
+                        VkImage& outImage,
+                        VkDeviceMemory& outMemory,
+                        VkImageView& outView) {
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = format;
+    imageInfo.extent = {extent.width, extent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | usage;
+
+    ASSERT_VK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &outImage));
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(device, outImage, &memoryRequirements);
+
+    VkMemoryAllocateInfo memoryAllocateInfo = {};
+    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocateInfo.allocationSize = memoryRequirements.size;
+    memoryAllocateInfo.memoryTypeIndex =
+        FindMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    ASSERT_VK_RESULT(vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &outMemory));
+
+    ASSERT_VK_RESULT(vkBindImageMemory(device, outImage, outMemory, 0));
+
+    VkImageViewCreateInfo imageViewInfo = {};
+    imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewInfo.format = format;
+    imageViewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewInfo.subresourceRange.baseMipLevel = 0;
+    imageViewInfo.subresourceRange.levelCount = 1;
+    imageViewInfo.subresourceRange.baseArrayLayer = 0;
+    imageViewInfo.subresourceRange.layerCount = 1;
+    imageViewInfo.image = outImage;
+    imageViewInfo.components.r = VK_COMPONENT_SWIZZLE_R;
+    imageViewInfo.components.g = VK_COMPONENT_SWIZZLE_G;
+    imageViewInfo.components.b = VK_COMPONENT_SWIZZLE_B;
+    imageViewInfo.components.a = VK_COMPONENT_SWIZZLE_A;
+
+    ASSERT_VK_RESULT(vkCreateImageView(device, &imageViewInfo, nullptr, &outView));
+}
+
+// one set per output image and top-level acceleration structure, set ii * tlas count + jj traces
+// TLAS jj into outputViews[ii]
+void CreateTraceDescriptorSets(const std::vector<VkImageView>& outputViews,
+                               VkDescriptorPool& outPool,
+                               std::vector<VkDescriptorSet>& outSets) {
+    const uint32_t tlasCount = (uint32_t)topLevelAccelerationStructures.size();
+    const uint32_t setCount = (uint32_t)outputViews.size() * tlasCount;
+
+    std::vector<VkDescriptorPoolSize> poolSizes(
+        {{VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, setCount},
+         {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount * 2}});
+
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.maxSets = setCount;
+    descriptorPoolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+
+    ASSERT_VK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &outPool));
+
+    const std::vector<VkDescriptorSetLayout> setLayouts(setCount, descriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = outPool;
+    descriptorSetAllocateInfo.descriptorSetCount = setCount;
+    descriptorSetAllocateInfo.pSetLayouts = setLayouts.data();
+
+    outSets.resize(setCount);
+    ASSERT_VK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, outSets.data()));
+
+    // the sets only differ in the TLAS they point at and the image they write
+    for (uint32_t ii = 0; ii < setCount; ++ii) {
+        VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo = {};
+        descriptorAccelerationStructureInfo.sType =
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+        descriptorAccelerationStructureInfo.accelerationStructureCount = 1;
+        descriptorAccelerationStructureInfo.pAccelerationStructures =
+            &topLevelAccelerationStructures[ii % tlasCount].handle;
+
+        VkWriteDescriptorSet accelerationStructureWrite = {};
+        accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        accelerationStructureWrite.pNext = &descriptorAccelerationStructureInfo;
+        accelerationStructureWrite.dstSet = outSets[ii];
+        accelerationStructureWrite.dstBinding = 0;
+        accelerationStructureWrite.descriptorCount = 1;
+        accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+
+        VkDescriptorImageInfo storageImageInfo = {};
+        storageImageInfo.sampler = VK_NULL_HANDLE;
+        storageImageInfo.imageView = outputViews[ii / tlasCount];
+        storageImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet outputImageWrite = {};
+        outputImageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        outputImageWrite.pNext = nullptr;
+        outputImageWrite.dstSet = outSets[ii];
+        outputImageWrite.dstBinding = 1;
+        outputImageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        outputImageWrite.descriptorCount = 1;
+        outputImageWrite.pImageInfo = &storageImageInfo;
+
+        VkDescriptorImageInfo accumulationImageInfo = {};
+        accumulationImageInfo.sampler = VK_NULL_HANDLE;
+        accumulationImageInfo.imageView = accumulationImageView;
+        accumulationImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet accumulationImageWrite = {};
+        accumulationImageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        accumulationImageWrite.pNext = nullptr;
+        accumulationImageWrite.dstSet = outSets[ii];
+        accumulationImageWrite.dstBinding = 2;
+        accumulationImageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        accumulationImageWrite.descriptorCount = 1;
+        accumulationImageWrite.pImageInfo = &accumulationImageInfo;
+
+        std::vector<VkWriteDescriptorSet> descriptorWrites(
+            {accelerationStructureWrite, outputImageWrite, accumulationImageWrite});
+
+        vkUpdateDescriptorSets(device, (uint32_t)descriptorWrites.size(),
+                               descriptorWrites.data(), 0, nullptr);
+    };
+}
+
+// waits only for srcStageMask and blocks only dstStageMask, so work outside of the two stages
+// keeps running across the barrier
+void InsertCommandImageBarrier(VkCommandBuffer commandBuffer,
+                               VkImage image,
+                               VkPipelineStageFlags srcStageMask,
+                               VkAccessFlags srcAccessMask,
+                               VkPipelineStageFlags dstStageMask,
+                               VkAccessFlags dstAccessMask,
+                               VkImageLayout oldLayout,
+                               VkImageLayout newLayout,
+                               const VkImageSubresourceRange& subresourceRange) {
+    VkImageMemoryBarrier imageMemoryBarrier = {};
+    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageMemoryBarrier.srcAccessMask = srcAccessMask;
+    imageMemoryBarrier.dstAccessMask = dstAccessMask;
+    imageMemoryBarrier.oldLayout = oldLayout;
+    imageMemoryBarrier.newLayout = newLayout;
+    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.image = image;
+    imageMemoryBarrier.subresourceRange = subresourceRange;
+
+    vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, 0, nullptr, 1,
+                         &imageMemoryBarrier);
+}
+
+#ifdef _WIN32
+LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+    MsgInfo info{hWnd, uMsg, wParam, lParam};
+    switch (info.uMsg) {
+        case WM_CLOSE:
+            DestroyWindow(info.hWnd);
+            PostQuitMessage(0);
+            break;
+    }
+    return (DefWindowProc(hWnd, uMsg, wParam, lParam));
+}
+
+bool CreateAppWindow() {
+    windowInstance = GetModuleHandle(0);
+
+    WNDCLASSEX wndClass;
+    wndClass.cbSize = sizeof(WNDCLASSEX);
     wndClass.style = CS_HREDRAW | CS_VREDRAW;
     wndClass.lpfnWndProc = WndProc;
     wndClass.cbClsExtra = 0;
@@ -353,38 +2764,1134 @@ int main() {
     wndClass.lpszClassName = appName.c_str();
     wndClass.hIconSm = LoadIcon(nullptr, IDI_WINLOGO);
 
-    if (!RegisterClassEx(&wndClass)) {
-        std::cout << "Failed to create window" << std::endl;
-        return EXIT_FAILURE;
+    if (!RegisterClassEx(&wndClass)) {
+        std::cout << "Failed to create window" << std::endl;
+        return false;
+    }
+
+    const DWORD exStyle = WS_EX_APPWINDOW | WS_EX_WINDOWEDGE;
+    const DWORD style = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_CLIPSIBLINGS | WS_CLIPCHILDREN;
+
+    RECT windowRect;
+    windowRect.left = 0;
+    windowRect.top = 0;
+    windowRect.right = desiredWindowWidth;
+    windowRect.bottom = desiredWindowHeight;
+    AdjustWindowRectEx(&windowRect, style, FALSE, exStyle);
+
+    window = CreateWindowEx(0, appName.c_str(), appName.c_str(),
+                            style | WS_CLIPSIBLINGS | WS_CLIPCHILDREN, 0, 0,
+                            windowRect.right - windowRect.left, windowRect.bottom - windowRect.top,
+                            nullptr, nullptr, windowInstance, nullptr);
+
+    if (!window) {
+        std::cout << "Failed to create window" << std::endl;
+        return false;
+    }
+
+    const uint32_t x = ((uint32_t)GetSystemMetrics(SM_CXSCREEN) - windowRect.right) / 2;
+    const uint32_t y = ((uint32_t)GetSystemMetrics(SM_CYSCREEN) - windowRect.bottom) / 2;
+    SetWindowPos(window, 0, x, y, 0, 0, SWP_NOZORDER | SWP_NOSIZE);
+
+    ShowWindow(window, SW_SHOW);
+    SetForegroundWindow(window);
+    SetFocus(window);
+
+    return true;
+}
+#endif
+
+bool IsValidationLayerAvailable(const char* layerName) {
+    uint32_t propertyCount = 0;
+    ASSERT_VK_RESULT(vkEnumerateInstanceLayerProperties(&propertyCount, nullptr));
+    std::vector<VkLayerProperties> properties(propertyCount);
+    ASSERT_VK_RESULT(vkEnumerateInstanceLayerProperties(&propertyCount, properties.data()));
+    // loop through all toggled layers and check if we can enable each
+    for (unsigned int ii = 0; ii < properties.size(); ++ii) {
+        if (strcmp(layerName, properties[ii].layerName) == 0) {
+            return true;
+        }
+    };
+    return false;
+}
+
+// the ray generation shader uses a fixed camera, so loaded scenes are centered and scaled
+// into the same [-1, 1] volume the built-in triangle occupies
+void FitSceneToView(Scene& scene) {
+    std::vector<float> meshBounds(scene.meshes.size() * 6);
+    for (size_t ii = 0; ii < scene.meshes.size(); ++ii) {
+        const SceneMesh& mesh = scene.meshes[ii];
+        float* bounds = &meshBounds[ii * 6];
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+            bounds[axis] = FLT_MAX;
+            bounds[axis + 3] = -FLT_MAX;
+        };
+        for (uint32_t vv = 0; vv < mesh.vertexCount; ++vv) {
+            const float* position = &scene.positions[((size_t)mesh.firstVertex + vv) * 3];
+            for (uint32_t axis = 0; axis < 3; ++axis) {
+                bounds[axis] = std::min(bounds[axis], position[axis]);
+                bounds[axis + 3] = std::max(bounds[axis + 3], position[axis]);
+            };
+        };
+    };
+
+    // transform the corners of every instance's mesh bounds into world space
+    float sceneMin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float sceneMax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (const SceneInstance& instance : scene.instances) {
+        const float* bounds = &meshBounds[instance.meshIndex * 6];
+        if (scene.meshes[instance.meshIndex].vertexCount == 0) {
+            continue;
+        }
+        for (uint32_t corner = 0; corner < 8; ++corner) {
+            const float point[3] = {bounds[(corner & 1) ? 3 : 0], bounds[(corner & 2) ? 4 : 1],
+                                    bounds[(corner & 4) ? 5 : 2]};
+            for (uint32_t row = 0; row < 3; ++row) {
+                const float* t = instance.transform[row];
+                const float value = t[0] * point[0] + t[1] * point[1] + t[2] * point[2] + t[3];
+                sceneMin[row] = std::min(sceneMin[row], value);
+                sceneMax[row] = std::max(sceneMax[row], value);
+            };
+        };
+    };
+    if (sceneMin[0] > sceneMax[0]) {
+        return;
+    }
+
+    float center[3];
+    float extent = 0.0f;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        center[axis] = 0.5f * (sceneMin[axis] + sceneMax[axis]);
+        extent = std::max(extent, 0.5f * (sceneMax[axis] - sceneMin[axis]));
+    };
+    const float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+
+    for (SceneInstance& instance : scene.instances) {
+        for (uint32_t row = 0; row < 3; ++row) {
+            for (uint32_t column = 0; column < 4; ++column) {
+                instance.transform[row][column] *= scale;
+            };
+            instance.transform[row][3] -= center[row] * scale;
+        };
+    };
+}
+
+// the built-in triangle is used unless a scene file is given
+bool LoadTracedScene(Scene& out) {
+    if (!scenePath.empty()) {
+        if (!LoadScene(threadPool, scenePath, sceneCacheEnabled, out)) {
+            return false;
+        }
+        FitSceneToView(out);
+        return true;
+    }
+
+    // clang-format off
+    out.positionStorage = {
+         1.0f,  1.0f, 0.0f,
+        -1.0f,  1.0f, 0.0f,
+         0.0f, -1.0f, 0.0f
+    };
+    out.indexStorage = {
+        0, 1, 2
+    };
+    // clang-format on
+    UseSceneStorage(out);
+    SceneMesh mesh = {};
+    mesh.vertexCount = 3;
+    mesh.indexCount = 3;
+    out.meshes = {mesh};
+    out.instances = {SceneInstance()};
+    return true;
+}
+
+// half of the rays are camera rays in scanline order like picking queries, the other half start
+// at random points and go in random directions like visibility and collision probes
+void RunRayCastBenchmark(const CpuBvh& bvh) {
+    auto buildStart = std::chrono::high_resolution_clock::now();
+    CpuBvh8 bvh8;
+    BuildCpuBvh8(bvh, bvh8);
+    auto buildEnd = std::chrono::high_resolution_clock::now();
+    std::cout << "Built BVH8 with " << bvh8.nodes.size() << " nodes, " << bvh8.leaves.size()
+              << " leaves and " << bvh8.packs.size() << " triangle packs in "
+              << std::chrono::duration<double, std::milli>(buildEnd - buildStart).count()
+              << "ms" << std::endl;
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    const uint32_t pixelCount = desiredWindowWidth * desiredWindowHeight;
+    const float aspect = (float)desiredWindowWidth / (float)desiredWindowHeight;
+    std::vector<CpuRayQuery> rays(rayCastBenchmarkRayCount);
+    for (uint32_t ii = 0; ii < rayCastBenchmarkRayCount; ++ii) {
+        CpuRayQuery& ray = rays[ii];
+        if (ii < rayCastBenchmarkRayCount / 2) {
+            const uint32_t pixel = ii % pixelCount;
+            ray.origin[2] = -1.5f;
+            ray.direction[0] =
+                ((float)(pixel % desiredWindowWidth) + 0.5f) / desiredWindowWidth * 2.0f - 1.0f;
+            ray.direction[0] *= aspect;
+            ray.direction[1] =
+                ((float)(pixel / desiredWindowWidth) + 0.5f) / desiredWindowHeight * 2.0f - 1.0f;
+            ray.direction[2] = 1.0f;
+        } else {
+            for (uint32_t axis = 0; axis < 3; ++axis) {
+                ray.origin[axis] = distribution(random);
+                ray.direction[axis] = distribution(random);
+            };
+        }
+        const float length = std::sqrt(ray.direction[0] * ray.direction[0] +
+                                       ray.direction[1] * ray.direction[1] +
+                                       ray.direction[2] * ray.direction[2]);
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+            ray.direction[axis] /= std::max(length, FLT_MIN);
+        };
+        ray.tMin = 0.001f;
+        ray.tMax = 100.0f;
+    };
+
+    std::vector<CpuRayQueryHit> scalarHits(rayCastBenchmarkRayCount);
+    std::vector<CpuRayQueryHit> hits(rayCastBenchmarkRayCount);
+    double scalarRate = 0.0;
+    for (uint32_t kernel = 0; kernel < cpuRayKernelCount; ++kernel) {
+        if (!IsCpuRayKernelSupported(kernel)) {
+            std::cout << "Skipping the " << GetCpuRayKernelName(kernel)
+                      << " ray-cast kernel, the CPU doesn't support it" << std::endl;
+            continue;
+        }
+
+        double totalMs = 0.0;
+        for (uint32_t iteration = 0; iteration < cpuReferenceIterations; ++iteration) {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (uint32_t first = 0; first < rayCastBenchmarkRayCount; first += rayCastBatchSize) {
+                const uint32_t count = std::min(rayCastBatchSize, rayCastBenchmarkRayCount - first);
+                CastCpuRays(bvh8, &rays[first], &hits[first], count, kernel);
+            };
+            auto end = std::chrono::high_resolution_clock::now();
+            totalMs += std::chrono::duration<double, std::milli>(end - start).count();
+        };
+
+        if (kernel == cpuRayKernelScalar) {
+            scalarHits = hits;
+        }
+        uint32_t hitCount = 0;
+        uint32_t mismatchCount = 0;
+        for (uint32_t ii = 0; ii < rayCastBenchmarkRayCount; ++ii) {
+            hitCount += hits[ii].primitiveIndex != cpuRayMiss ? 1 : 0;
+            mismatchCount += hits[ii].primitiveIndex != scalarHits[ii].primitiveIndex ? 1 : 0;
+        };
+
+        const double rate =
+            (double)rayCastBenchmarkRayCount * cpuReferenceIterations / (totalMs / 1000.0);
+        if (kernel == cpuRayKernelScalar) {
+            scalarRate = rate;
+        }
+        std::cout << "Cast " << rayCastBenchmarkRayCount << " rays with the "
+                  << GetCpuRayKernelName(kernel) << " kernel at " << rate / 1000000.0
+                  << " Mrays/s (" << rate / scalarRate << "x scalar, " << hitCount << " hits, "
+                  << mismatchCount << " differ from scalar)" << std::endl;
+    };
+}
+
+// traces the scene on 1, 2, 4, .. pool threads without touching Vulkan, so it also runs on
+// machines without a ray tracing device and gives a reference image for the GPU path. the
+// ray-cast benchmark runs on the same BVH first if requested
+int RunCpuReference() {
+    Scene scene;
+    if (!LoadTracedScene(scene)) {
+        return EXIT_FAILURE;
+    }
+
+    auto buildStart = std::chrono::high_resolution_clock::now();
+    CpuBvh bvh;
+    BuildCpuBvh(scene, bvh);
+    auto buildEnd = std::chrono::high_resolution_clock::now();
+    ReleaseScene(scene);
+    std::cout << "Built CPU BVH over " << bvh.triangles.size() << " triangles with "
+              << bvh.nodes.size() << " nodes in "
+              << std::chrono::duration<double, std::milli>(buildEnd - buildStart).count()
+              << "ms" << std::endl;
+
+    if (rayCastBenchmarkRayCount > 0) {
+        RunRayCastBenchmark(bvh);
+    }
+    if (!cpuReference) {
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t threadCount = 1; threadCount < GetThreadCount(threadPool); threadCount *= 2) {
+        threadCounts.push_back(threadCount);
+    };
+    threadCounts.push_back(GetThreadCount(threadPool));
+
+    CpuImage image;
+    image.width = desiredWindowWidth;
+    image.height = desiredWindowHeight;
+    double singleThreadRate = 0.0;
+    for (uint32_t threadCount : threadCounts) {
+        uint64_t rayCount = 0;
+        double totalMs = 0.0;
+        uint32_t stolenTileCount = 0;
+        for (uint32_t ii = 0; ii < cpuReferenceIterations; ++ii) {
+            CpuRenderStats stats;
+            RenderCpuImage(threadPool, threadCount, bvh, image, stats);
+            rayCount += stats.rayCount;
+            totalMs += stats.milliseconds;
+            stolenTileCount += stats.stolenTileCount;
+        };
+        const double raysPerSecond = (double)rayCount / (totalMs / 1000.0);
+        if (threadCount == 1) {
+            singleThreadRate = raysPerSecond;
+        }
+        std::cout << "Traced " << rayCount / cpuReferenceIterations << " rays on " << threadCount
+                  << " threads at " << raysPerSecond / 1000000.0 << " Mrays/s ("
+                  << raysPerSecond / singleThreadRate << "x, "
+                  << stolenTileCount / cpuReferenceIterations << " tiles stolen)" << std::endl;
+    };
+
+    if (!cpuReferenceImagePath.empty()) {
+        if (!WriteCpuImage(cpuReferenceImagePath, image)) {
+            std::cout << "Could not write " << cpuReferenceImagePath << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Wrote " << cpuReferenceImagePath << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+void ParseArguments(int argc, char* argv[]) {
+    for (int ii = 1; ii < argc; ++ii) {
+        const std::string arg = argv[ii];
+        const bool hasValue = ii + 1 < argc;
+        if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--offline" && hasValue) {
+            offlineImagePath = argv[++ii];
+            headless = true;
+        } else if (arg == "--tile-size" && hasValue) {
+            offlineTileSize = std::max(1u, (uint32_t)std::strtoul(argv[++ii], nullptr, 10));
+        } else if (arg == "--frames" && hasValue) {
+            benchmarkFrameCount = (uint32_t)std::strtoul(argv[++ii], nullptr, 10);
+        } else if (arg == "--compact") {
+            compactAccelerationStructures = true;
+        } else if (arg == "--animate") {
+            animateInstances = true;
+        } else if (arg == "--progressive") {
+            progressiveAccumulation = true;
+        } else if (arg == "--samples" && hasValue) {
+            samplesPerLaunch = std::max(1u, (uint32_t)std::strtoul(argv[++ii], nullptr, 10));
+        } else if (arg == "--frames-in-flight" && hasValue) {
+            framesInFlight = std::max(1u, (uint32_t)std::strtoul(argv[++ii], nullptr, 10));
+        } else if (arg == "--profile") {
+            gpuProfilerEnabled = true;
+        } else if (arg == "--transfer-queue") {
+            useTransferQueue = true;
+        } else if (arg == "--async-compute") {
+            useAsyncCompute = true;
+        } else if (arg == "--scene" && hasValue) {
+            scenePath = argv[++ii];
+        } else if (arg == "--no-scene-cache") {
+            sceneCacheEnabled = false;
+        } else if (arg == "--no-blas-cache") {
+            blasCacheEnabled = false;
+        } else if (arg == "--blas-build" && hasValue) {
+            blasBuildMode = argv[++ii];
+        } else if (arg == "--present" && hasValue) {
+            presentPath = argv[++ii];
+        } else if (arg == "--scratch-budget" && hasValue) {
+            scratchBatchBudget =
+                (VkDeviceSize)std::strtoull(argv[++ii], nullptr, 10) * 1024 * 1024;
+        } else if (arg == "--record-benchmark" && hasValue) {
+            recordBenchmarkJobCount = (uint32_t)std::strtoul(argv[++ii], nullptr, 10);
+        } else if (arg == "--cpu-reference") {
+            cpuReference = true;
+        } else if (arg == "--raycast-benchmark" && hasValue) {
+            rayCastBenchmarkRayCount = (uint32_t)std::strtoul(argv[++ii], nullptr, 10);
+        } else if (arg == "--cpu-image" && hasValue) {
+            cpuReferenceImagePath = argv[++ii];
+        } else if (arg == "--threads" && hasValue) {
+            workerThreadCount = (uint32_t)std::strtoul(argv[++ii], nullptr, 10);
+        } else if (arg == "--width" && hasValue) {
+            desiredWindowWidth = (uint32_t)std::strtoul(argv[++ii], nullptr, 10);
+        } else if (arg == "--height" && hasValue) {
+            desiredWindowHeight = (uint32_t)std::strtoul(argv[++ii], nullptr, 10);
+        } else {
+            std::cout << "Ignoring unknown argument '" << arg << "'" << std::endl;
+        }
+    };
+}
+
+VkRect2D GetImageRegion() {
+    VkRect2D region = {};
+    region.extent = {desiredWindowWidth, desiredWindowHeight};
+    return region;
+}
+
+// offline renders trace one tile at a time, so their images only need to hold one tile
+VkExtent2D GetTraceImageExtent() {
+    if (offlineImagePath.empty()) {
+        return {desiredWindowWidth, desiredWindowHeight};
+    }
+    return {std::min(offlineTileSize, desiredWindowWidth),
+            std::min(offlineTileSize, desiredWindowHeight)};
+}
+
+// animated instances change the scene every frame, so their frames never build on each other
+uint32_t GetAccumulatedFrameCount(uint32_t frameIndex) {
+    if (!progressiveAccumulation || animateInstances) {
+        return 0;
+    }
+    return frameIndex;
+}
+
+// the set that traces the ring slot's TLAS into the offscreen buffer, or into the swapchain image
+// with direct presents
+VkDescriptorSet GetTraceDescriptorSet(uint32_t ringIndex, uint32_t swapchainImageIndex) {
+    const uint32_t tlasIndex = ringIndex % (uint32_t)descriptorSets.size();
+    if (directPresent && swapchainImageIndex != noSwapchainImage) {
+        return presentDescriptorSets[swapchainImageIndex * descriptorSets.size() + tlasIndex];
+    }
+    return descriptorSets[tlasIndex];
+}
+
+// traces region of the whole image into the top left of the offscreen buffer, or all of it into
+// the swapchain image with direct presents. accumulatedFrameCount is the number of frames the
+// accumulation image already averages
+void RecordTraceCommands(VkCommandBuffer commandBuffer,
+                         uint32_t ringIndex,
+                         uint32_t swapchainImageIndex,
+                         uint32_t accumulatedFrameCount,
+                         const VkRect2D& region) {
+    VkImageSubresourceRange subresourceRange = {};
+    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresourceRange.baseMipLevel = 0;
+    subresourceRange.levelCount = 1;
+    subresourceRange.baseArrayLayer = 0;
+    subresourceRange.layerCount = 1;
+
+    // transition the output into shader writeable state. the offscreen buffer was last written by
+    // the previous trace and read by a copy, a swapchain image is chained to the acquire
+    // semaphore, which is waited on at the ray tracing stage
+    if (directPresent && swapchainImageIndex != noSwapchainImage) {
+        InsertCommandImageBarrier(commandBuffer, swapchainImages[swapchainImageIndex],
+                                  VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0,
+                                  VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                  VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                                  VK_IMAGE_LAYOUT_GENERAL, subresourceRange);
+    } else {
+        InsertCommandImageBarrier(commandBuffer, offscreenBuffer,
+                                  VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                                      VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  VK_ACCESS_SHADER_WRITE_BIT,
+                                  VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                  VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                                  VK_IMAGE_LAYOUT_GENERAL, subresourceRange);
+    }
+
+    // a new accumulation discards the old average, otherwise the previous frame's writes must be
+    // visible before they are read back
+    const VkImageLayout accumulationLayout =
+        accumulatedFrameCount == 0 ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_GENERAL;
+    InsertCommandImageBarrier(commandBuffer, accumulationImage,
+                              VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                              VK_ACCESS_SHADER_WRITE_BIT,
+                              VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                              VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                              accumulationLayout, VK_IMAGE_LAYOUT_GENERAL, subresourceRange);
+
+    TracePushConstants pushConstants;
+    pushConstants.tileOffset[0] = (uint32_t)region.offset.x;
+    pushConstants.tileOffset[1] = (uint32_t)region.offset.y;
+    pushConstants.imageSize[0] = desiredWindowWidth;
+    pushConstants.imageSize[1] = desiredWindowHeight;
+    pushConstants.frameIndex = accumulatedFrameCount;
+    pushConstants.sampleCount = samplesPerLaunch;
+    pushConstants.progressive = progressiveAccumulation ? 1 : 0;
+
+    // record ray tracing
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline);
+    const VkDescriptorSet descriptorSet = GetTraceDescriptorSet(ringIndex, swapchainImageIndex);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipelineLayout,
+                            0, 1, &descriptorSet, 0, 0);
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0,
+                       sizeof(TracePushConstants), &pushConstants);
+
+    ext::vkCmdTraceRaysKHR(commandBuffer, &shaderBindingTable.rayGenRegion,
+                           &shaderBindingTable.missRegion, &shaderBindingTable.hitRegion,
+                           &shaderBindingTable.callableRegion, region.extent.width,
+                           region.extent.height, 1);
+}
+
+void RecordSwapchainCopy(VkCommandBuffer commandBuffer, VkImage swapchainImage) {
+    VkImageCopy copyRegion = {};
+    copyRegion.srcOffset = {0, 0, 0};
+    copyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.srcSubresource.mipLevel = 0;
+    copyRegion.srcSubresource.baseArrayLayer = 0;
+    copyRegion.srcSubresource.layerCount = 1;
+    copyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.dstSubresource.mipLevel = 0;
+    copyRegion.dstSubresource.baseArrayLayer = 0;
+    copyRegion.dstSubresource.layerCount = 1;
+    copyRegion.extent.depth = 1;
+    copyRegion.extent.width = desiredWindowWidth;
+    copyRegion.extent.height = desiredWindowHeight;
+    copyRegion.dstOffset = {0, 0, 0};
+
+    VkImageSubresourceRange subresourceRange = {};
+    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresourceRange.baseMipLevel = 0;
+    subresourceRange.levelCount = 1;
+    subresourceRange.baseArrayLayer = 0;
+    subresourceRange.layerCount = 1;
+
+    // transition swapchain image into copy destination state, chained to the acquire semaphore
+    // which is waited on at the transfer stage
+    InsertCommandImageBarrier(commandBuffer, swapchainImage, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                              VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                              VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              subresourceRange);
+
+    // transition offscreen buffer into copy source state
+    InsertCommandImageBarrier(commandBuffer, offscreenBuffer,
+                              VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                              VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                              VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange);
+
+    // copy offscreen buffer into swapchain image
+    vkCmdCopyImage(commandBuffer, offscreenBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   swapchainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+    // transition swapchain image into presentable state, the present semaphore makes the write
+    // visible
+    InsertCommandImageBarrier(commandBuffer, swapchainImage, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                              VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                              0, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, subresourceRange);
+}
+
+// with direct presents the trace already wrote the swapchain image, it only changes layout
+void RecordPresentTransition(VkCommandBuffer commandBuffer, VkImage swapchainImage) {
+    VkImageSubresourceRange subresourceRange = {};
+    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresourceRange.baseMipLevel = 0;
+    subresourceRange.levelCount = 1;
+    subresourceRange.baseArrayLayer = 0;
+    subresourceRange.layerCount = 1;
+
+    InsertCommandImageBarrier(commandBuffer, swapchainImage,
+                              VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                              VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                              VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                              subresourceRange);
+}
+
+// copies the traced part of the offscreen buffer into a host visible buffer, tightly packed
+void RecordTileReadback(VkCommandBuffer commandBuffer,
+                        VkBuffer readbackBuffer,
+                        const VkRect2D& region) {
+    VkImageSubresourceRange subresourceRange = {};
+    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresourceRange.baseMipLevel = 0;
+    subresourceRange.levelCount = 1;
+    subresourceRange.baseArrayLayer = 0;
+    subresourceRange.layerCount = 1;
+
+    // transition offscreen buffer into copy source state
+    InsertCommandImageBarrier(commandBuffer, offscreenBuffer,
+                              VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                              VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                              VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange);
+
+    VkBufferImageCopy copyRegion = {};
+    copyRegion.bufferOffset = 0;
+    copyRegion.bufferRowLength = 0;
+    copyRegion.bufferImageHeight = 0;
+    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.imageSubresource.mipLevel = 0;
+    copyRegion.imageSubresource.baseArrayLayer = 0;
+    copyRegion.imageSubresource.layerCount = 1;
+    copyRegion.imageOffset = {0, 0, 0};
+    copyRegion.imageExtent = {region.extent.width, region.extent.height, 1};
+
+    vkCmdCopyImageToBuffer(commandBuffer, offscreenBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           readbackBuffer, 1, &copyRegion);
+
+    // make the tile visible to the host
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+VkCommandBuffer AcquireSecondaryCommandBuffer(ThreadCommandPool& commandPool) {
+    if (commandPool.usedCount == commandPool.commandBuffers.size()) {
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferAllocateInfo.commandPool = commandPool.pool;
+        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        commandBufferAllocateInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        ASSERT_VK_RESULT(
+            vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer));
+        commandPool.commandBuffers.push_back(commandBuffer);
     }
+    return commandPool.commandBuffers[commandPool.usedCount++];
+}
 
-    const DWORD exStyle = WS_EX_APPWINDOW | WS_EX_WINDOWEDGE;
-    const DWORD style = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_CLIPSIBLINGS | WS_CLIPCHILDREN;
+// the GPU must be done with every secondary recorded for this frame
+void ResetThreadCommandPools(FrameResources& frame) {
+    for (ThreadCommandPool& commandPool : frame.threadCommandPools) {
+        if (commandPool.usedCount > 0) {
+            ASSERT_VK_RESULT(vkResetCommandPool(device, commandPool.pool, 0));
+            commandPool.usedCount = 0;
+        }
+    };
+}
 
-    RECT windowRect;
-    windowRect.left = 0;
-    windowRect.top = 0;
-    windowRect.right = desiredWindowWidth;
-    windowRect.bottom = desiredWindowHeight;
-    AdjustWindowRectEx(&windowRect, style, FALSE, exStyle);
+// records every job into its own secondary command buffer on at most threadCount pool threads,
+// each thread allocating from its own command pool so no pool is ever shared
+std::vector<VkCommandBuffer> RecordJobsInParallel(FrameResources& frame,
+                                                  const std::vector<RecordJob>& jobs,
+                                                  uint32_t threadCount) {
+    std::vector<VkCommandBuffer> out(jobs.size(), VK_NULL_HANDLE);
+    const uint32_t taskCount = std::min((uint32_t)jobs.size(), threadCount);
 
-    window = CreateWindowEx(0, appName.c_str(), appName.c_str(),
-                            style | WS_CLIPSIBLINGS | WS_CLIPCHILDREN, 0, 0,
-                            windowRect.right - windowRect.left, windowRect.bottom - windowRect.top,
-                            nullptr, nullptr, windowInstance, nullptr);
+    RunParallel(threadPool, taskCount, [&](uint32_t taskIndex, uint32_t threadIndex) {
+        ThreadCommandPool& commandPool = frame.threadCommandPools[threadIndex];
 
-    if (!window) {
-        std::cout << "Failed to create window" << std::endl;
+        // secondaries outside of a render pass inherit nothing
+        VkCommandBufferInheritanceInfo inheritanceInfo = {};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+        VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        commandBufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        for (size_t ii = taskIndex; ii < jobs.size(); ii += taskCount) {
+            VkCommandBuffer commandBuffer = AcquireSecondaryCommandBuffer(commandPool);
+            ASSERT_VK_RESULT(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+            jobs[ii].record(commandBuffer);
+            ASSERT_VK_RESULT(vkEndCommandBuffer(commandBuffer));
+            out[ii] = commandBuffer;
+        };
+    });
+    return out;
+}
+
+// executes the recorded jobs in order, timestamps are written from the primary so the
+// profiler state is only touched on this thread
+void ExecuteRecordedJobs(VkCommandBuffer commandBuffer,
+                         const std::vector<RecordJob>& jobs,
+                         const std::vector<VkCommandBuffer>& secondaryCommandBuffers,
+                         uint32_t ringIndex) {
+    for (size_t ii = 0; ii < jobs.size(); ++ii) {
+        GpuScope scope = BeginGpuScope(commandBuffer, ringIndex, jobs[ii].scopeName);
+        vkCmdExecuteCommands(commandBuffer, 1, &secondaryCommandBuffers[ii]);
+        EndGpuScope(commandBuffer, ringIndex, scope);
+    };
+}
+
+std::vector<RecordJob> GetFrameRecordJobs(uint32_t swapchainImageIndex, uint32_t frameIndex) {
+    const uint32_t ringIndex = frameIndex % framesInFlight;
+    std::vector<RecordJob> jobs;
+
+    // async builds are recorded into the frame's compute command buffer instead
+    if (animateInstances && !asyncComputeBuilds) {
+        const VkBuildAccelerationStructureModeKHR mode = GetTopLevelBuildMode(frameIndex);
+        RecordJob updateJob;
+        updateJob.scopeName = "tlas update";
+        updateJob.record = [ringIndex, mode](VkCommandBuffer commandBuffer) {
+            RecordTopLevelBuild(commandBuffer, GetFrameTopLevelAccelerationStructure(ringIndex),
+                                ringIndex, mode);
+        };
+        jobs.push_back(updateJob);
+    }
+
+    RecordJob traceJob;
+    traceJob.scopeName = "trace rays";
+    const uint32_t accumulatedFrameCount = GetAccumulatedFrameCount(frameIndex);
+    traceJob.record = [ringIndex, swapchainImageIndex,
+                       accumulatedFrameCount](VkCommandBuffer commandBuffer) {
+        RecordTraceCommands(commandBuffer, ringIndex, swapchainImageIndex, accumulatedFrameCount,
+                            GetImageRegion());
+    };
+    jobs.push_back(traceJob);
+
+    if (swapchainImageIndex == noSwapchainImage) {
+        return jobs;
+    }
+    const VkImage swapchainImage = swapchainImages[swapchainImageIndex];
+    if (directPresent) {
+        RecordJob presentJob;
+        presentJob.scopeName = "present transition";
+        presentJob.record = [swapchainImage](VkCommandBuffer commandBuffer) {
+            RecordPresentTransition(commandBuffer, swapchainImage);
+        };
+        jobs.push_back(presentJob);
+    } else {
+        RecordJob copyJob;
+        copyJob.scopeName = "copy to swapchain";
+        copyJob.record = [swapchainImage](VkCommandBuffer commandBuffer) {
+            RecordSwapchainCopy(commandBuffer, swapchainImage);
+        };
+        jobs.push_back(copyJob);
+    }
+    return jobs;
+}
+
+// waiting for the frame's submission also covers its compute command buffer, the main queue
+// waited on it
+void RecordAsyncBuildCommands(FrameResources& frame, uint32_t frameIndex) {
+    const uint32_t ringIndex = frameIndex % framesInFlight;
+
+    VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+    commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    ASSERT_VK_RESULT(vkBeginCommandBuffer(frame.computeCommandBuffer, &commandBufferBeginInfo));
+    WriteAsyncOverlapTimestamp(frame.computeCommandBuffer, ringIndex, false, false);
+    RecordTopLevelBuild(frame.computeCommandBuffer,
+                        GetFrameTopLevelAccelerationStructure(ringIndex), ringIndex,
+                        GetTopLevelBuildMode(frameIndex));
+    WriteAsyncOverlapTimestamp(frame.computeCommandBuffer, ringIndex, false, true);
+    ASSERT_VK_RESULT(vkEndCommandBuffer(frame.computeCommandBuffer));
+}
+
+// records the per-frame work, presenting is skipped for noSwapchainImage. the frame's last
+// submission must have finished, its secondaries are recycled
+void RecordFrameCommands(FrameResources& frame, uint32_t swapchainImageIndex, uint32_t frameIndex) {
+    ResetThreadCommandPools(frame);
+
+    const std::vector<RecordJob> jobs = GetFrameRecordJobs(swapchainImageIndex, frameIndex);
+    const std::vector<VkCommandBuffer> secondaryCommandBuffers =
+        RecordJobsInParallel(frame, jobs, GetThreadCount(threadPool));
+
+    VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+    commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    commandBufferBeginInfo.flags = 0;
+
+    ASSERT_VK_RESULT(vkBeginCommandBuffer(frame.commandBuffer, &commandBufferBeginInfo));
+
+    const uint32_t ringIndex = frameIndex % framesInFlight;
+    BeginGpuProfilerFrame(frame.commandBuffer, ringIndex);
+    WriteAsyncOverlapTimestamp(frame.commandBuffer, ringIndex, true, false);
+    ExecuteRecordedJobs(frame.commandBuffer, jobs, secondaryCommandBuffers, ringIndex);
+    WriteAsyncOverlapTimestamp(frame.commandBuffer, ringIndex, true, true);
+
+    ASSERT_VK_RESULT(vkEndCommandBuffer(frame.commandBuffer));
+
+    if (asyncComputeBuilds) {
+        RecordAsyncBuildCommands(frame, frameIndex);
+    }
+}
+
+// submits the frame's TLAS build to the compute queue when builds run there, then the frame
+// itself, which waits for its build. the build waits for the previous submission of the same
+// ring slot, the last one that traced its TLAS
+void SubmitFrame(FrameResources& frame, VkSemaphore waitSemaphore, VkSemaphore signalSemaphore) {
+    std::vector<SubmissionWait> waits;
+    if (waitSemaphore != VK_NULL_HANDLE) {
+        // the acquired image is first written by the trace with direct presents, else by the copy,
+        // so the TLAS update and trace of the copy path never wait for the presentation engine
+        const VkPipelineStageFlags waitStage = directPresent
+                                                   ? VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                                                   : VK_PIPELINE_STAGE_TRANSFER_BIT;
+        waits.push_back({waitSemaphore, 0, waitStage});
+    }
+    if (asyncComputeBuilds) {
+        // the first builds also wait for the ones at load time, they share the scratch pool
+        const uint64_t tracedValue = std::max(frame.submitValue, scratchPool.lastUseValue);
+        const uint64_t buildValue =
+            SubmitTracked(computeTimeline, frame.computeCommandBuffer,
+                          {{mainTimeline.semaphore, tracedValue,
+                            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR}});
+        waits.push_back(
+            {computeTimeline.semaphore, buildValue, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR});
+    }
+    frame.submitValue = SubmitTracked(mainTimeline, frame.commandBuffer, waits, signalSemaphore);
+}
+
+void CreateFrameResources() {
+    frames.resize(framesInFlight);
+
+    std::vector<VkCommandBuffer> commandBuffers(framesInFlight);
+
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = commandPool;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = framesInFlight;
+
+    ASSERT_VK_RESULT(
+        vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, commandBuffers.data()));
+
+    std::vector<VkCommandBuffer> computeCommandBuffers(framesInFlight, VK_NULL_HANDLE);
+    if (asyncComputeBuilds) {
+        commandBufferAllocateInfo.commandPool = computeCommandPool;
+        ASSERT_VK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo,
+                                                  computeCommandBuffers.data()));
+    }
+    CreateAsyncOverlapQueries();
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    // secondaries are never reset one by one, only together with their pool
+    VkCommandPoolCreateInfo commandPoolInfo = {};
+    commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    commandPoolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    for (uint32_t ii = 0; ii < framesInFlight; ++ii) {
+        FrameResources& frame = frames[ii];
+        frame.commandBuffer = commandBuffers[ii];
+        frame.computeCommandBuffer = computeCommandBuffers[ii];
+        frame.threadCommandPools.resize(GetThreadCount(threadPool));
+        for (ThreadCommandPool& commandPool : frame.threadCommandPools) {
+            ASSERT_VK_RESULT(
+                vkCreateCommandPool(device, &commandPoolInfo, nullptr, &commandPool.pool));
+        };
+        ASSERT_VK_RESULT(
+            vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.semaphoreImageAvailable));
+        ASSERT_VK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                                           &frame.semaphoreRenderingAvailable));
+    };
+}
+
+void DestroyFrameResources() {
+    for (FrameResources& frame : frames) {
+        vkDestroySemaphore(device, frame.semaphoreRenderingAvailable, nullptr);
+        vkDestroySemaphore(device, frame.semaphoreImageAvailable, nullptr);
+        vkFreeCommandBuffers(device, commandPool, 1, &frame.commandBuffer);
+        if (frame.computeCommandBuffer != VK_NULL_HANDLE) {
+            vkFreeCommandBuffers(device, computeCommandPool, 1, &frame.computeCommandBuffer);
+        }
+        for (ThreadCommandPool& threadCommandPool : frame.threadCommandPools) {
+            vkDestroyCommandPool(device, threadCommandPool.pool, nullptr);
+        };
+    };
+    frames.clear();
+
+    DestroyAsyncOverlapQueries();
+}
+
+// records recordBenchmarkJobCount traces, each after a TLAS build when the TLAS is dynamic, into
+// secondaries on a growing number of threads. nothing is submitted, only the CPU time of
+// recording is measured
+void RunRecordingBenchmark() {
+    std::vector<RecordJob> jobs(recordBenchmarkJobCount);
+    for (RecordJob& job : jobs) {
+        job.record = [](VkCommandBuffer commandBuffer) {
+            // a static TLAS has already released its build inputs
+            if (animateInstances) {
+                RecordTopLevelBuild(commandBuffer, GetFrameTopLevelAccelerationStructure(0), 0,
+                                    VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+            }
+            RecordTraceCommands(commandBuffer, 0, noSwapchainImage, 0, GetImageRegion());
+        };
+    };
+
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t threadCount = 1; threadCount < GetThreadCount(threadPool); threadCount *= 2) {
+        threadCounts.push_back(threadCount);
+    };
+    threadCounts.push_back(GetThreadCount(threadPool));
+
+    FrameResources& frame = frames[0];
+    double singleThreadMs = 0.0;
+    for (uint32_t threadCount : threadCounts) {
+        double totalMs = 0.0;
+        for (uint32_t ii = 0; ii < recordBenchmarkIterations; ++ii) {
+            ResetThreadCommandPools(frame);
+            auto start = std::chrono::high_resolution_clock::now();
+            RecordJobsInParallel(frame, jobs, threadCount);
+            auto end = std::chrono::high_resolution_clock::now();
+            totalMs += std::chrono::duration<double, std::milli>(end - start).count();
+        };
+        const double averageMs = totalMs / recordBenchmarkIterations;
+        if (threadCount == 1) {
+            singleThreadMs = averageMs;
+        }
+        std::cout << "Recorded " << recordBenchmarkJobCount << " jobs on " << threadCount
+                  << " threads in " << averageMs << "ms (" << (singleThreadMs / averageMs)
+                  << "x)" << std::endl;
+    };
+    ResetThreadCommandPools(frame);
+}
+
+int RunHeadlessBenchmark() {
+    std::cout << "Running headless benchmark with " << benchmarkFrameCount << " frames at "
+              << desiredWindowWidth << "x" << desiredWindowHeight << ".." << std::endl;
+
+    CreateFrameResources();
+
+    if (recordBenchmarkJobCount > 0) {
+        RunRecordingBenchmark();
+    }
+
+    // without animation or accumulation every frame traces the same, so recording once per frame
+    // suffices
+    for (uint32_t ii = 0; ii < framesInFlight; ++ii) {
+        RecordFrameCommands(frames[ii], noSwapchainImage, ii);
+    };
+
+    // warm up once so pipeline and cache setup costs don't end up in the measurement
+    WaitForSubmission(mainTimeline, SubmitTracked(mainTimeline, frames[0].commandBuffer));
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (uint32_t frameIndex = 0; frameIndex < benchmarkFrameCount; ++frameIndex) {
+        const uint32_t index = frameIndex % framesInFlight;
+        FrameResources& frame = frames[index];
+        WaitForSubmission(mainTimeline, frame.submitValue);
+        CollectDeferredReleases(false);
+        ResolveGpuProfilerFrame(index, false);
+        ResolveAsyncOverlap(index);
+
+        // the wait guarantees that the instance buffer of this ring slot is no longer read
+        if (animateInstances) {
+            WriteAnimatedInstances(GetFrameTopLevelAccelerationStructure(index), index,
+                                   frameIndex);
+        }
+        // accumulating frames push a different frame index every time
+        if (animateInstances || progressiveAccumulation) {
+            RecordFrameCommands(frame, noSwapchainImage, frameIndex);
+        }
+
+        SubmitFrame(frame, VK_NULL_HANDLE, VK_NULL_HANDLE);
+    };
+    ASSERT_VK_RESULT(vkQueueWaitIdle(queue));
+
+    auto end = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+
+    // samplesPerLaunch primary rays are launched per pixel
+    const double rayCount = (double)desiredWindowWidth * (double)desiredWindowHeight *
+                            (double)benchmarkFrameCount * (double)samplesPerLaunch;
+
+    std::cout << "Traced " << benchmarkFrameCount << " frames in " << seconds << "s" << std::endl;
+    std::cout << "Frames/s: " << (benchmarkFrameCount / seconds) << std::endl;
+    std::cout << "Mrays/s: " << (rayCount / seconds / 1e6) << std::endl;
+    if (progressiveAccumulation && benchmarkFrameCount > 0) {
+        const uint32_t samplesPerPixel =
+            (GetAccumulatedFrameCount(benchmarkFrameCount - 1) + 1) * samplesPerLaunch;
+        std::cout << "Accumulated " << samplesPerPixel << " samples per pixel" << std::endl;
+    }
+
+    // the last frames in flight are resolved in the order they were submitted
+    for (uint32_t ii = 0; ii < framesInFlight; ++ii) {
+        const uint32_t index = (benchmarkFrameCount + ii) % framesInFlight;
+        ResolveGpuProfilerFrame(index, false);
+        ResolveAsyncOverlap(index);
+    };
+    PrintGpuProfilerStats();
+    PrintAsyncOverlapStats();
+
+    DestroyFrameResources();
+    DestroyGpuProfiler();
+    DestroyPipelineCache();
+    DestroyTopLevelAccelerationStructures();
+    DestroyScratchPool();
+    DestroySubmissionTimelines();
+    DestroyThreadPool(threadPool);
+
+    return EXIT_SUCCESS;
+}
+
+// the host reads every tile back, which is several times faster from cached memory
+VkMemoryPropertyFlags GetReadbackMemoryProperties() {
+    const VkMemoryPropertyFlags cachedProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                                                   VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    for (uint32_t ii = 0; ii < memoryProperties.memoryTypeCount; ++ii) {
+        if ((memoryProperties.memoryTypes[ii].propertyFlags & cachedProperties) ==
+            cachedProperties) {
+            return cachedProperties;
+        }
+    };
+    return VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+// tiles are numbered row by row, the last ones of a row or column may be cut off by the image
+VkRect2D GetOfflineTileRegion(uint32_t tileIndex, VkExtent2D tileExtent, uint32_t tileCountX) {
+    const uint32_t x = (tileIndex % tileCountX) * tileExtent.width;
+    const uint32_t y = (tileIndex / tileCountX) * tileExtent.height;
+
+    VkRect2D region = {};
+    region.offset = {(int32_t)x, (int32_t)y};
+    region.extent = {std::min(tileExtent.width, desiredWindowWidth - x),
+                     std::min(tileExtent.height, desiredWindowHeight - y)};
+    return region;
+}
+
+// converts a finished tile into rgb rows of its band, bands are one row of tiles high
+void CopyTileToBand(const OfflineTileSlot& slot,
+                    const VkRect2D& region,
+                    std::vector<uint8_t>& band) {
+    // the offscreen buffer has the surface format, which may store blue first
+    const bool bgra = desiredSurfaceFormat == VK_FORMAT_B8G8R8A8_UNORM;
+    const uint8_t* pixels = (const uint8_t*)slot.readbackBuffer.allocation.mappedData;
+    for (uint32_t y = 0; y < region.extent.height; ++y) {
+        const uint8_t* src = pixels + (size_t)y * region.extent.width * 4;
+        uint8_t* dst = &band[((size_t)y * desiredWindowWidth + region.offset.x) * 3];
+        for (uint32_t x = 0; x < region.extent.width; ++x) {
+            dst[x * 3 + 0] = src[x * 4 + (bgra ? 2 : 0)];
+            dst[x * 3 + 1] = src[x * 4 + 1];
+            dst[x * 3 + 2] = src[x * 4 + (bgra ? 0 : 2)];
+        };
+    };
+}
+
+// traces the image one tile per submission, so no launch exceeds the dispatch limits or runs
+// long enough to trip the driver's timeout. frames in flight overlap tracing with the readback
+// of earlier tiles, and every finished row of tiles is appended to the .ppm right away
+int RunOfflineRender() {
+    const VkExtent2D tileExtent = GetTraceImageExtent();
+    const uint32_t tileCountX = (desiredWindowWidth + tileExtent.width - 1) / tileExtent.width;
+    const uint32_t tileCountY = (desiredWindowHeight + tileExtent.height - 1) / tileExtent.height;
+    const uint32_t tileCount = tileCountX * tileCountY;
+
+    std::cout << "Rendering " << desiredWindowWidth << "x" << desiredWindowHeight << " in "
+              << tileCount << " tiles of " << tileExtent.width << "x" << tileExtent.height
+              << " into " << offlineImagePath << ".." << std::endl;
+
+    std::ofstream file(offlineImagePath, std::ios::binary);
+    if (!file) {
+        std::cout << "Could not write " << offlineImagePath << std::endl;
         return EXIT_FAILURE;
     }
+    file << "P6\n" << desiredWindowWidth << " " << desiredWindowHeight << "\n255\n";
 
-    const uint32_t x = ((uint32_t)GetSystemMetrics(SM_CXSCREEN) - windowRect.right) / 2;
-    const uint32_t y = ((uint32_t)GetSystemMetrics(SM_CYSCREEN) - windowRect.bottom) / 2;
-    SetWindowPos(window, 0, x, y, 0, 0, SWP_NOZORDER | SWP_NOSIZE);
+    CreateFrameResources();
 
-    ShowWindow(window, SW_SHOW);
-    SetForegroundWindow(window);
-    SetFocus(window);
+    const VkDeviceSize readbackSize = (VkDeviceSize)tileExtent.width * tileExtent.height * 4;
+    const VkMemoryPropertyFlags readbackProperties = GetReadbackMemoryProperties();
+    std::vector<OfflineTileSlot> slots(framesInFlight);
+    for (OfflineTileSlot& slot : slots) {
+        slot.readbackBuffer = CreateAccelerationBuffer(
+            readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, 1, readbackProperties);
+    };
+
+    // rows of the .ppm run across every tile of a band
+    std::vector<uint8_t> band((size_t)desiredWindowWidth * tileExtent.height * 3);
+
+    // tiles finish in the order they were submitted, so a band is complete with its last tile
+    auto writeTile = [&](OfflineTileSlot& slot) {
+        WaitForSubmission(mainTimeline, slot.submitValue);
+        const VkRect2D region = GetOfflineTileRegion(slot.tileIndex, tileExtent, tileCountX);
+        CopyTileToBand(slot, region, band);
+        if (slot.tileIndex % tileCountX == tileCountX - 1) {
+            file.write(reinterpret_cast<const char*>(band.data()),
+                       (std::streamsize)desiredWindowWidth * region.extent.height * 3);
+        }
+        slot.pending = false;
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+    commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    for (uint32_t tileIndex = 0; tileIndex < tileCount; ++tileIndex) {
+        const uint32_t index = tileIndex % framesInFlight;
+        OfflineTileSlot& slot = slots[index];
+        FrameResources& frame = frames[index];
+
+        // the slot's readback buffer and command buffer are reused once its tile is written out
+        if (slot.pending) {
+            writeTile(slot);
+        }
+        CollectDeferredReleases(false);
+
+        const VkRect2D region = GetOfflineTileRegion(tileIndex, tileExtent, tileCountX);
+        ASSERT_VK_RESULT(vkBeginCommandBuffer(frame.commandBuffer, &commandBufferBeginInfo));
+        RecordTraceCommands(frame.commandBuffer, 0, noSwapchainImage, 0, region);
+        RecordTileReadback(frame.commandBuffer, slot.readbackBuffer.buffer, region);
+        ASSERT_VK_RESULT(vkEndCommandBuffer(frame.commandBuffer));
+
+        slot.submitValue = SubmitTracked(mainTimeline, frame.commandBuffer);
+        frame.submitValue = slot.submitValue;
+        slot.tileIndex = tileIndex;
+        slot.pending = true;
+    };
+
+    // the last tiles in flight are written in the order they were submitted
+    for (uint32_t ii = 0; ii < framesInFlight; ++ii) {
+        OfflineTileSlot& slot = slots[(tileCount + ii) % framesInFlight];
+        if (slot.pending) {
+            writeTile(slot);
+        }
+    };
+
+    auto end = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+
+    const double rayCount =
+        (double)desiredWindowWidth * (double)desiredWindowHeight * (double)samplesPerLaunch;
+    const VkDeviceSize tileMemory = (VkDeviceSize)tileExtent.width * tileExtent.height *
+                                    (4 + 16) + readbackSize * framesInFlight;
+
+    std::cout << "Rendered " << tileCount << " tiles in " << seconds << "s" << std::endl;
+    std::cout << "Mrays/s: " << (rayCount / seconds / 1e6) << std::endl;
+    std::cout << "Tile images and readback buffers: " << (tileMemory / (1024 * 1024)) << " MiB"
+              << std::endl;
+
+    file.close();
+    const bool written = (bool)file;
+    if (written) {
+        std::cout << "Wrote " << offlineImagePath << std::endl;
+    } else {
+        std::cout << "Could not write " << offlineImagePath << std::endl;
+    }
+
+    for (OfflineTileSlot& slot : slots) {
+        DestroyBuffer(slot.readbackBuffer);
+    };
+    DestroyFrameResources();
+    DestroyGpuProfiler();
+    DestroyPipelineCache();
+    DestroyTopLevelAccelerationStructures();
+    DestroyScratchPool();
+    DestroySubmissionTimelines();
+    DestroyThreadPool(threadPool);
+
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    ParseArguments(argc, argv);
+    CreateThreadPool(threadPool, workerThreadCount);
+
+    if (cpuReference || rayCastBenchmarkRayCount > 0) {
+        const int exitCode = RunCpuReference();
+        DestroyThreadPool(threadPool);
+        return exitCode;
+    }
+
+#ifdef _WIN32
+    if (!headless && !CreateAppWindow()) {
+        return EXIT_FAILURE;
+    }
+#else
+    if (!headless) {
+        std::cout << "Windowed mode is only supported on Windows, use --headless" << std::endl;
+        return EXIT_FAILURE;
+    }
+#endif
+
+    // surface and swapchain support is only required when presenting to a window
+    if (!headless) {
+        instanceExtensions.insert(instanceExtensions.end(), surfaceInstanceExtensions.begin(),
+                                  surfaceInstanceExtensions.end());
+        deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 
     // check which validation layers are available
     std::vector<const char*> availableValidationLayers;
@@ -451,12 +3958,108 @@ int main() {
     vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
     std::cout << "GPU: " << deviceProperties.deviceName << std::endl;
 
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                             queueFamilies.data());
+
+    // a transfer-only family maps to the copy engines and runs uploads beside other work
+    transferQueueFamilyIndex = queueFamilyIndex;
+    if (useTransferQueue) {
+        for (uint32_t ii = 0; ii < queueFamilyCount; ++ii) {
+            const VkQueueFlags flags = queueFamilies[ii].queueFlags;
+            if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+                !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                transferQueueFamilyIndex = ii;
+                break;
+            }
+        };
+        if (transferQueueFamilyIndex == queueFamilyIndex) {
+            std::cout << "No dedicated transfer queue found, uploading on the main queue"
+                      << std::endl;
+        }
+    }
+
+    // a compute-only family usually maps to async compute queues that run beside graphics work
+    computeQueueFamilyIndex = queueFamilyIndex;
+    if (useAsyncCompute && !animateInstances) {
+        std::cout << "Async compute only moves TLAS updates, ignoring it without --animate"
+                  << std::endl;
+    } else if (useAsyncCompute) {
+        for (uint32_t ii = 0; ii < queueFamilyCount; ++ii) {
+            const VkQueueFlags flags = queueFamilies[ii].queueFlags;
+            if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+                computeQueueFamilyIndex = ii;
+                break;
+            }
+        };
+        if (computeQueueFamilyIndex == queueFamilyIndex) {
+            std::cout << "No dedicated compute queue found, building on the main queue"
+                      << std::endl;
+        } else {
+            asyncComputeBuilds = true;
+            const uint32_t validBits = queueFamilies[computeQueueFamilyIndex].timestampValidBits;
+            computeTimestampMask =
+                validBits >= 64 ? UINT64_MAX : validBits == 0 ? 0 : ((1ull << validBits) - 1);
+        }
+    }
+
     const float queuePriority = 0.0f;
 
+    std::vector<VkDeviceQueueCreateInfo> deviceQueueInfos;
+
     VkDeviceQueueCreateInfo deviceQueueInfo = {};
     deviceQueueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    deviceQueueInfo.queueFamilyIndex = queueFamilyIndex;
     deviceQueueInfo.queueCount = 1;
     deviceQueueInfo.pQueuePriorities = &queuePriority;
+    deviceQueueInfos.push_back(deviceQueueInfo);
+
+    if (transferQueueFamilyIndex != queueFamilyIndex) {
+        deviceQueueInfo.queueFamilyIndex = transferQueueFamilyIndex;
+        deviceQueueInfos.push_back(deviceQueueInfo);
+    }
+
+    if (computeQueueFamilyIndex != queueFamilyIndex) {
+        deviceQueueInfo.queueFamilyIndex = computeQueueFamilyIndex;
+        deviceQueueInfos.push_back(deviceQueueInfo);
+    }
+
+    // acquire RT AS features, host commands are only enabled when host builds are used
+    rayTracingAccelerationFeatures.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+    VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+    deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures2.pNext = &rayTracingAccelerationFeatures;
+
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures2);
+
+    // the ray generation shader writes the B8G8R8A8 offscreen buffer and swapchain images through
+    // an image declared without a format, on either present path
+    if (!deviceFeatures2.features.shaderStorageImageWriteWithoutFormat) {
+        std::cout << "Storage image writes without format are not supported" << std::endl;
+        return EXIT_FAILURE;
+    }
+    VkPhysicalDeviceFeatures deviceEnabledFeatures = {};
+    deviceEnabledFeatures.shaderStorageImageWriteWithoutFormat = VK_TRUE;
+
+    const bool hostCommandsSupported =
+        rayTracingAccelerationFeatures.accelerationStructureHostCommands == VK_TRUE;
+    if (blasBuildMode == "host") {
+        if (!hostCommandsSupported) {
+            std::cout << "Host acceleration structure builds are not supported" << std::endl;
+            return EXIT_FAILURE;
+        }
+        hostAccelerationStructureBuilds = true;
+    } else if (blasBuildMode == "auto") {
+        hostAccelerationStructureBuilds = hostCommandsSupported;
+    } else if (blasBuildMode != "device") {
+        std::cout << "Unknown BLAS build mode " << blasBuildMode << std::endl;
+        return EXIT_FAILURE;
+    }
 
     // chain multiple features required for RT into deviceInfo.pNext
 
@@ -467,437 +4070,287 @@ int main() {
     deviceBufferDeviceAddressFeatures.bufferDeviceAddress = VK_TRUE;
     deviceBufferDeviceAddressFeatures.pNext = nullptr;
 
+    // every submission is tracked with timeline semaphores, core in Vulkan 1.2
+    VkPhysicalDeviceTimelineSemaphoreFeatures deviceTimelineSemaphoreFeatures = {};
+    deviceTimelineSemaphoreFeatures.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    deviceTimelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+    deviceTimelineSemaphoreFeatures.pNext = &deviceBufferDeviceAddressFeatures;
+
     // require ray tracing pipeline feature
     VkPhysicalDeviceRayTracingPipelineFeaturesKHR deviceRayTracingPipelineFeatures = {};
     deviceRayTracingPipelineFeatures.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
     deviceRayTracingPipelineFeatures.rayTracingPipeline = VK_TRUE;
-    deviceRayTracingPipelineFeatures.pNext = &deviceBufferDeviceAddressFeatures;
+    deviceRayTracingPipelineFeatures.pNext = &deviceTimelineSemaphoreFeatures;
 
     // require acceleration structure feature
     VkPhysicalDeviceAccelerationStructureFeaturesKHR deviceAccelerationStructureFeatures = {};
     deviceAccelerationStructureFeatures.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
     deviceAccelerationStructureFeatures.accelerationStructure = VK_TRUE;
+    deviceAccelerationStructureFeatures.accelerationStructureHostCommands =
+        hostAccelerationStructureBuilds ? VK_TRUE : VK_FALSE;
     deviceAccelerationStructureFeatures.pNext = &deviceRayTracingPipelineFeatures;
 
     VkDeviceCreateInfo deviceInfo = {};
     deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     deviceInfo.pNext = &deviceAccelerationStructureFeatures;
-    deviceInfo.queueCreateInfoCount = 1;
-    deviceInfo.pQueueCreateInfos = &deviceQueueInfo;
+    deviceInfo.queueCreateInfoCount = (uint32_t)deviceQueueInfos.size();
+    deviceInfo.pQueueCreateInfos = deviceQueueInfos.data();
     deviceInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
     deviceInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    deviceInfo.pEnabledFeatures = &deviceEnabledFeatures;
 
     ASSERT_VK_RESULT(vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device));
 
-    vkGetDeviceQueue(device, 0, 0, &queue);
+    vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+    vkGetDeviceQueue(device, transferQueueFamilyIndex, 0, &transferQueue);
+    vkGetDeviceQueue(device, computeQueueFamilyIndex, 0, &computeQueue);
+
+    CreateSubmissionTimeline(mainTimeline, queue);
+    CreateSubmissionTimeline(transferTimeline, transferQueue);
+    if (asyncComputeBuilds) {
+        CreateSubmissionTimeline(computeTimeline, computeQueue);
+    }
 
     // clang-format off
-    RESOLVE_VK_INSTANCE_PFN(instance, vkGetPhysicalDeviceSurfaceSupportKHR);
+    if (!headless) {
+        RESOLVE_VK_INSTANCE_PFN(instance, vkGetPhysicalDeviceSurfaceSupportKHR);
 
-    RESOLVE_VK_DEVICE_PFN(device, vkCreateSwapchainKHR);
-    RESOLVE_VK_DEVICE_PFN(device, vkGetSwapchainImagesKHR);
+        RESOLVE_VK_DEVICE_PFN(device, vkCreateSwapchainKHR);
+        RESOLVE_VK_DEVICE_PFN(device, vkGetSwapchainImagesKHR);
+    }
 
     RESOLVE_VK_DEVICE_PFN(device, vkGetBufferDeviceAddressKHR);
 
     RESOLVE_VK_DEVICE_PFN(device, vkCreateAccelerationStructureKHR);
     RESOLVE_VK_DEVICE_PFN(device, vkCreateRayTracingPipelinesKHR);
     RESOLVE_VK_DEVICE_PFN(device, vkCmdBuildAccelerationStructuresKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkBuildAccelerationStructuresKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkWriteAccelerationStructuresPropertiesKHR);
     RESOLVE_VK_DEVICE_PFN(device, vkGetAccelerationStructureBuildSizesKHR);
     RESOLVE_VK_DEVICE_PFN(device, vkDestroyAccelerationStructureKHR);
     RESOLVE_VK_DEVICE_PFN(device, vkGetRayTracingShaderGroupHandlesKHR);
     RESOLVE_VK_DEVICE_PFN(device, vkCmdTraceRaysKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkCmdWriteAccelerationStructuresPropertiesKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkCmdCopyAccelerationStructureKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkCmdCopyAccelerationStructureToMemoryKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkCmdCopyMemoryToAccelerationStructureKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkGetDeviceAccelerationStructureCompatibilityKHR);
+
+    RESOLVE_VK_DEVICE_PFN(device, vkCreateDeferredOperationKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkDestroyDeferredOperationKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkGetDeferredOperationMaxConcurrencyKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkGetDeferredOperationResultKHR);
+    RESOLVE_VK_DEVICE_PFN(device, vkDeferredOperationJoinKHR);
     RESOLVE_VK_DEVICE_PFN(device, vkGetAccelerationStructureDeviceAddressKHR);
     // clang-format on
 
-    VkWin32SurfaceCreateInfoKHR surfaceCreateInfo = {};
-    surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-    surfaceCreateInfo.hinstance = windowInstance;
-    surfaceCreateInfo.hwnd = window;
+#ifdef _WIN32
+    if (!headless) {
+        VkWin32SurfaceCreateInfoKHR surfaceCreateInfo = {};
+        surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+        surfaceCreateInfo.hinstance = windowInstance;
+        surfaceCreateInfo.hwnd = window;
 
-    ASSERT_VK_RESULT(vkCreateWin32SurfaceKHR(instance, &surfaceCreateInfo, nullptr, &surface));
+        ASSERT_VK_RESULT(
+            vkCreateWin32SurfaceKHR(instance, &surfaceCreateInfo, nullptr, &surface));
 
-    VkBool32 surfaceSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, 0, surface, &surfaceSupport);
-    if (!surfaceSupport) {
-        std::cout << "No surface rendering support" << std::endl;
-        return EXIT_FAILURE;
+        VkBool32 surfaceSupport = false;
+        ext::vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, queueFamilyIndex, surface,
+                                                  &surfaceSupport);
+        if (!surfaceSupport) {
+            std::cout << "No surface rendering support" << std::endl;
+            return EXIT_FAILURE;
+        }
     }
+#endif
 
     VkCommandPoolCreateInfo cmdPoolInfo = {};
     cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
 
     ASSERT_VK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
 
+    cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    cmdPoolInfo.queueFamilyIndex = transferQueueFamilyIndex;
+
+    ASSERT_VK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &transferCommandPool));
+
+    if (asyncComputeBuilds) {
+        cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        cmdPoolInfo.queueFamilyIndex = computeQueueFamilyIndex;
+
+        ASSERT_VK_RESULT(
+            vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &computeCommandPool));
+    }
+
+    CreateStagingRing();
+
+    timestampPeriod = deviceProperties.limits.timestampPeriod;
+    CreateGpuProfiler(queueFamilies[queueFamilyIndex].timestampValidBits);
+
     // acquire RT properties
     rayTracingPipelineProperties.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+    accelerationStructureProperties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+    rayTracingPipelineProperties.pNext = &accelerationStructureProperties;
     VkPhysicalDeviceProperties2 deviceProperties2 = {};
     deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
     deviceProperties2.pNext = &rayTracingPipelineProperties;
 
     vkGetPhysicalDeviceProperties2(physicalDevice, &deviceProperties2);
 
-    // acquire RT AS features
-    rayTracingAccelerationFeatures.sType =
-        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
-    VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
-    deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
-    deviceFeatures2.pNext = &rayTracingAccelerationFeatures;
-
-    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures2);
-
-    struct Vertex {
-        float pos[3];
+    // a single offline tile may not launch more rays than the device allows
+    while (offlineTileSize > 1 && (uint64_t)offlineTileSize * offlineTileSize >
+                                      rayTracingPipelineProperties.maxRayDispatchInvocationCount) {
+        offlineTileSize /= 2;
     };
 
-    // clang-format off
-    std::vector<Vertex> vertices = {
-        { {  1.0f,  1.0f, 0.0f } },
-        { { -1.0f,  1.0f, 0.0f } },
-        { {  0.0f, -1.0f, 0.0f } }
-    };
-    std::vector<uint32_t> indices = {
-        0, 1, 2
-    };
-    // clang-format on
+    Scene scene;
+    if (!LoadTracedScene(scene)) {
+        return EXIT_FAILURE;
+    }
 
     // create bottom-level container
     {
         std::cout << "Creating Bottom-Level Acceleration Structure.." << std::endl;
 
-        MappedBuffer vertexBuffer = CreateMappedBuffer(
-            vertices.data(), sizeof(Vertex) * (uint32_t)vertices.size(),
+        // every mesh of the scene lives in one shared vertex and one shared index buffer
+        AccelerationMemory vertexBuffer = CreateDeviceLocalBuffer(
+            scene.positions, sizeof(Vertex) * scene.vertexCount,
             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
                 VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
 
-        MappedBuffer indexBuffer = CreateMappedBuffer(
-            indices.data(), sizeof(uint32_t) * (uint32_t)indices.size(),
+        AccelerationMemory indexBuffer = CreateDeviceLocalBuffer(
+            scene.indices, sizeof(uint32_t) * scene.indexCount,
             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
                 VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
 
-        VkDeviceOrHostAddressConstKHR vertexBufferDeviceAddress = {};
-        vertexBufferDeviceAddress.deviceAddress = vertexBuffer.deviceAddress;
-
-        VkDeviceOrHostAddressConstKHR indexBufferDeviceAddress = {};
-        indexBufferDeviceAddress.deviceAddress = indexBuffer.deviceAddress;
-
-        VkAccelerationStructureGeometryKHR asGeometryInfo = {};
-        asGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-        asGeometryInfo.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-        asGeometryInfo.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-        asGeometryInfo.geometry.triangles.sType =
-            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
-        asGeometryInfo.geometry.triangles.vertexData = vertexBufferDeviceAddress;
-        asGeometryInfo.geometry.triangles.indexData = indexBufferDeviceAddress;
-        asGeometryInfo.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-        asGeometryInfo.geometry.triangles.maxVertex = vertices.size();
-        asGeometryInfo.geometry.triangles.vertexStride = sizeof(Vertex);
-        asGeometryInfo.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
-
-        VkAccelerationStructureBuildGeometryInfoKHR asBuildSizeGeometryInfo = {};
-        asBuildSizeGeometryInfo.sType =
-            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-        asBuildSizeGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-        asBuildSizeGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-        asBuildSizeGeometryInfo.geometryCount = 1;
-        asBuildSizeGeometryInfo.pGeometries = &asGeometryInfo;
-
-        // aquire size to build acceleration structure
-        const uint32_t primitiveCount = vertices.size() / 3;
-        VkAccelerationStructureBuildSizesInfoKHR asBuildSizesInfo = {};
-        asBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-        vkGetAccelerationStructureBuildSizesKHR(
-            device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &asBuildSizeGeometryInfo,
-            &primitiveCount, &asBuildSizesInfo);
-
-        // reserve memory to hold the acceleration structure
-        AccelerationMemory bottomLevelASMemory =
-            CreateAccelerationBuffer(asBuildSizesInfo.accelerationStructureSize,
-                                     VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
-                                         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-
-        VkAccelerationStructureCreateInfoKHR accelerationStructureInfo = {};
-        accelerationStructureInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-        accelerationStructureInfo.buffer = bottomLevelASMemory.buffer;
-        accelerationStructureInfo.size = asBuildSizesInfo.accelerationStructureSize;
-        accelerationStructureInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-
-        ASSERT_VK_RESULT(vkCreateAccelerationStructureKHR(device, &accelerationStructureInfo,
-                                                          nullptr, &bottomLevelAS));
-
-        // reserve memory to build acceleration structure
-        AccelerationMemory scratchMemory = CreateAccelerationBuffer(
-            asBuildSizesInfo.buildScratchSize,
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-
-        VkAccelerationStructureBuildGeometryInfoKHR asBuildGeometryInfo = {};
-        asBuildGeometryInfo.sType =
-            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-        asBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-        asBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-        asBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-        asBuildGeometryInfo.dstAccelerationStructure = bottomLevelAS;
-        asBuildGeometryInfo.geometryCount = 1;
-        asBuildGeometryInfo.pGeometries = &asGeometryInfo;
-        asBuildGeometryInfo.scratchData.deviceAddress = scratchMemory.deviceAddress;
-
-        VkAccelerationStructureBuildRangeInfoKHR asBuildRangeInfo = {};
-        asBuildRangeInfo.primitiveCount = primitiveCount;
-        asBuildRangeInfo.primitiveOffset = 0;
-        asBuildRangeInfo.firstVertex = 0;
-        asBuildRangeInfo.transformOffset = 0;
-        std::vector<VkAccelerationStructureBuildRangeInfoKHR*> asBuildRangeInfos = {
-            &asBuildRangeInfo};
-
-        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-
-        VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        commandBufferAllocateInfo.commandPool = commandPool;
-        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        commandBufferAllocateInfo.commandBufferCount = 1;
-
-        ASSERT_VK_RESULT(
-            vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer));
-
-        VkCommandBufferBeginInfo commandBufferBeginInfo = {};
-        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-        ASSERT_VK_RESULT(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+        // cache keys are hashed while the uploads are in flight
+        std::vector<uint64_t> blasCacheKeys;
+        for (const SceneMesh& sceneMesh : scene.meshes) {
+            blasCacheKeys.push_back(GetBlasCacheKey(scene, sceneMesh));
+        };
 
-        // build the bottom-level acceleration structure
-        vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &asBuildGeometryInfo,
-                                            asBuildRangeInfos.data());
+        // all geometry is staged before the device builds read it
+        FinishUploads();
+
+        std::vector<MeshGeometry> meshes;
+        for (const SceneMesh& sceneMesh : scene.meshes) {
+            MeshGeometry mesh = {};
+            mesh.vertexBufferAddress =
+                vertexBuffer.deviceAddress + sizeof(Vertex) * sceneMesh.firstVertex;
+            mesh.vertexCount = sceneMesh.vertexCount;
+            mesh.indexBufferAddress =
+                indexBuffer.deviceAddress + sizeof(uint32_t) * sceneMesh.firstIndex;
+            mesh.indexCount = sceneMesh.indexCount;
+            mesh.vertexData = scene.positions + 3 * sceneMesh.firstVertex;
+            mesh.indexData = scene.indices + sceneMesh.firstIndex;
+            meshes.push_back(mesh);
+        };
 
-        ASSERT_VK_RESULT(vkEndCommandBuffer(commandBuffer));
+        const std::string blasCachePath = scenePath.empty()
+                                              ? GetExecutablePath() + "/" + blasCacheFileName
+                                              : scenePath + ".blascache";
 
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+        auto restoreStart = std::chrono::high_resolution_clock::now();
+        uint32_t restoredCount = 0;
+        if (blasCacheEnabled) {
+            restoredCount =
+                LoadBlasCache(blasCachePath, blasCacheKeys, bottomLevelAccelerationStructures);
+        } else {
+            bottomLevelAccelerationStructures.resize(meshes.size());
+        }
 
-        VkFence fence = VK_NULL_HANDLE;
+        // only meshes missing from the cache are built
+        std::vector<MeshGeometry> missingMeshes;
+        std::vector<size_t> missingIndices;
+        for (size_t ii = 0; ii < meshes.size(); ++ii) {
+            if (bottomLevelAccelerationStructures[ii].handle == VK_NULL_HANDLE) {
+                missingMeshes.push_back(meshes[ii]);
+                missingIndices.push_back(ii);
+            }
+        };
 
-        VkFenceCreateInfo fenceInfo = {};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        std::vector<BottomLevelAccelerationStructure> builtStructures =
+            BuildBottomLevelAccelerationStructures(missingMeshes);
+        for (size_t ii = 0; ii < missingIndices.size(); ++ii) {
+            bottomLevelAccelerationStructures[missingIndices[ii]] = builtStructures[ii];
+        };
+        auto buildEnd = std::chrono::high_resolution_clock::now();
 
-        ASSERT_VK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
-        ASSERT_VK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-        ASSERT_VK_RESULT(vkWaitForFences(device, 1, &fence, true, UINT64_MAX));
+        // host builds read the geometry straight from the scene, so it is kept until here
+        ReleaseScene(scene);
 
-        vkDestroyFence(device, fence, nullptr);
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+        std::cout << "Restored " << restoredCount << " BLAS from cache in "
+                  << std::chrono::duration<double, std::milli>(buildStart - restoreStart).count()
+                  << "ms, built " << missingMeshes.size()
+                  << (hostAccelerationStructureBuilds ? " on the host in " : " on the device in ")
+                  << std::chrono::duration<double, std::milli>(buildEnd - buildStart).count()
+                  << "ms" << std::endl;
 
-        // Get bottom level acceleration structure handle for use in top level instances
-        VkAccelerationStructureDeviceAddressInfoKHR asDeviceAddressInfo = {};
-        asDeviceAddressInfo.sType =
-            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-        asDeviceAddressInfo.accelerationStructure = bottomLevelAS;
-        bottomLevelASHandle =
-            vkGetAccelerationStructureDeviceAddressKHR(device, &asDeviceAddressInfo);
-
-        // make sure bottom AS handle is valid
-        if (bottomLevelASHandle == 0) {
-            std::cout << "Invalid Handle to BLAS" << std::endl;
-            return EXIT_FAILURE;
+        if (blasCacheEnabled && !missingMeshes.empty()) {
+            SaveBlasCache(blasCachePath, blasCacheKeys, bottomLevelAccelerationStructures);
         }
+
+        // make sure bottom AS handles are valid
+        for (const BottomLevelAccelerationStructure& blas : bottomLevelAccelerationStructures) {
+            if (blas.deviceAddress == 0) {
+                std::cout << "Invalid Handle to BLAS" << std::endl;
+                return EXIT_FAILURE;
+            }
+        };
     }
 
     // create top-level container
     {
         std::cout << "Creating Top-Level Acceleration Structure.." << std::endl;
 
-        // clang-format off
-        VkTransformMatrixKHR instanceTransform = {
-            1.0f, 0.0f, 0.0f, 0.0f,
-            0.0f, 1.0f, 0.0f, 0.0f,
-            0.0f, 0.0f, 1.0f, 0.0f
+        sceneInstances.clear();
+        for (const SceneInstance& sceneInstance : scene.instances) {
+            VkAccelerationStructureInstanceKHR instance = {};
+            memcpy(&instance.transform, sceneInstance.transform, sizeof(instance.transform));
+            instance.instanceCustomIndex = 0;
+            instance.mask = 0xFF;
+            instance.instanceShaderBindingTableRecordOffset = 0;
+            instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+            instance.accelerationStructureReference =
+                bottomLevelAccelerationStructures[sceneInstance.meshIndex].deviceAddress;
+            sceneInstances.push_back(instance);
         };
-        // clang-format on
-
-        VkAccelerationStructureInstanceKHR instance = {};
-        instance.transform = instanceTransform;
-        instance.instanceCustomIndex = 0;
-        instance.mask = 0xFF;
-        instance.instanceShaderBindingTableRecordOffset = 0;
-        instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-        instance.accelerationStructureReference = bottomLevelASHandle;
-        std::vector<VkAccelerationStructureInstanceKHR> instances = {instance};
-
-        MappedBuffer instanceBuffer = CreateMappedBuffer(
-            instances.data(), sizeof(VkAccelerationStructureInstanceKHR),
-            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-                VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
-
-        VkDeviceOrHostAddressConstKHR instanceDataDeviceAddress = {};
-        instanceDataDeviceAddress.deviceAddress = instanceBuffer.deviceAddress;
-
-        VkAccelerationStructureGeometryKHR asGeometryInfo = {};
-        asGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-        asGeometryInfo.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-        asGeometryInfo.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-        asGeometryInfo.geometry.instances.sType =
-            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-        asGeometryInfo.geometry.instances.arrayOfPointers = VK_FALSE;
-        asGeometryInfo.geometry.instances.data = instanceDataDeviceAddress;
-
-        VkAccelerationStructureBuildGeometryInfoKHR asBuildSizeGeometryInfo = {};
-        asBuildSizeGeometryInfo.sType =
-            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-        asBuildSizeGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-        asBuildSizeGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-        asBuildSizeGeometryInfo.geometryCount = 1;
-        asBuildSizeGeometryInfo.pGeometries = &asGeometryInfo;
-
-        // aquire size to build acceleration structure
-        const uint32_t primitiveCount = 1;
-        VkAccelerationStructureBuildSizesInfoKHR asBuildSizesInfo = {};
-        asBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-        vkGetAccelerationStructureBuildSizesKHR(
-            device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &asBuildSizeGeometryInfo,
-            &primitiveCount, &asBuildSizesInfo);
-
-        // reserve memory to hold the acceleration structure
-        AccelerationMemory topLevelASMemory =
-            CreateAccelerationBuffer(asBuildSizesInfo.accelerationStructureSize,
-                                     VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
-                                         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-
-        VkAccelerationStructureCreateInfoKHR accelerationStructureInfo = {};
-        accelerationStructureInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-        accelerationStructureInfo.buffer = topLevelASMemory.buffer;
-        accelerationStructureInfo.size = asBuildSizesInfo.accelerationStructureSize;
-        accelerationStructureInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-
-        ASSERT_VK_RESULT(vkCreateAccelerationStructureKHR(device, &accelerationStructureInfo,
-                                                          nullptr, &topLevelAS));
-
-        // reserve memory to build acceleration structure
-        AccelerationMemory scratchMemory = CreateAccelerationBuffer(
-            asBuildSizesInfo.buildScratchSize,
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-
-        VkAccelerationStructureBuildGeometryInfoKHR asBuildGeometryInfo = {};
-        asBuildGeometryInfo.sType =
-            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-        asBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-        asBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-        asBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-        asBuildGeometryInfo.dstAccelerationStructure = topLevelAS;
-        asBuildGeometryInfo.geometryCount = 1;
-        asBuildGeometryInfo.pGeometries = &asGeometryInfo;
-        asBuildGeometryInfo.scratchData.deviceAddress = scratchMemory.deviceAddress;
-
-        VkAccelerationStructureBuildRangeInfoKHR asBuildRangeInfo = {};
-        asBuildRangeInfo.primitiveCount = primitiveCount;
-        asBuildRangeInfo.primitiveOffset = 0;
-        asBuildRangeInfo.firstVertex = 0;
-        asBuildRangeInfo.transformOffset = 0;
-        std::vector<VkAccelerationStructureBuildRangeInfoKHR*> asBuildRangeInfos = {
-            &asBuildRangeInfo};
-
-        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-
-        VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        commandBufferAllocateInfo.commandPool = commandPool;
-        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        commandBufferAllocateInfo.commandBufferCount = 1;
-
-        ASSERT_VK_RESULT(
-            vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer));
-
-        VkCommandBufferBeginInfo commandBufferBeginInfo = {};
-        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-        ASSERT_VK_RESULT(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
-
-        // build the top-level acceleration structure
-        vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &asBuildGeometryInfo,
-                                            asBuildRangeInfos.data());
 
-        ASSERT_VK_RESULT(vkEndCommandBuffer(commandBuffer));
+        topLevelAccelerationStructures.resize(asyncComputeBuilds ? framesInFlight : 1);
+        for (TopLevelAccelerationStructure& tlas : topLevelAccelerationStructures) {
+            CreateTopLevelAccelerationStructure(tlas, sceneInstances, animateInstances);
 
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
-
-        VkFence fence = VK_NULL_HANDLE;
-
-        VkFenceCreateInfo fenceInfo = {};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-
-        ASSERT_VK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
-        ASSERT_VK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-        ASSERT_VK_RESULT(vkWaitForFences(device, 1, &fence, true, UINT64_MAX));
-
-        vkDestroyFence(device, fence, nullptr);
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-
-        // Get top level acceleration structure handle
-        VkAccelerationStructureDeviceAddressInfoKHR deviceAddressInfo = {};
-        deviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-        deviceAddressInfo.accelerationStructure = topLevelAS;
-        topLevelASHandle = vkGetAccelerationStructureDeviceAddressKHR(device, &deviceAddressInfo);
-
-        // not actually necessary, but to be sure top AS handle is valid
-        if (topLevelASHandle == 0) {
-            std::cout << "Invalid Handle to TLAS" << std::endl;
-            return EXIT_FAILURE;
-        }
+            // not actually necessary, but to be sure top AS handle is valid
+            if (tlas.deviceAddress == 0) {
+                std::cout << "Invalid Handle to TLAS" << std::endl;
+                return EXIT_FAILURE;
+            }
+        };
     }
 
     // offscreen buffer
     {
         std::cout << "Creating Offsceen Buffer.." << std::endl;
 
-        VkImageCreateInfo imageInfo = {};
-        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.format = desiredSurfaceFormat;
-        imageInfo.extent = {desiredWindowWidth, desiredWindowHeight, 1};
-        imageInfo.mipLevels = 1;
-        imageInfo.arrayLayers = 1;
-        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-
-        ASSERT_VK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &offscreenBuffer));
-
-        VkMemoryRequirements memoryRequirements;
-        vkGetImageMemoryRequirements(device, offscreenBuffer, &memoryRequirements);
-
-        VkMemoryAllocateInfo memoryAllocateInfo = {};
-        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        memoryAllocateInfo.allocationSize = memoryRequirements.size;
-        memoryAllocateInfo.memoryTypeIndex =
-            FindMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-        ASSERT_VK_RESULT(
-            vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &offscreenBufferMemory));
-
-        ASSERT_VK_RESULT(vkBindImageMemory(device, offscreenBuffer, offscreenBufferMemory, 0));
+        CreateStorageImage(desiredSurfaceFormat, VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                           GetTraceImageExtent(), offscreenBuffer, offscreenBufferMemory,
+                           offscreenBufferView);
+    }
 
-        VkImageViewCreateInfo imageViewInfo = {};
-        imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        imageViewInfo.format = desiredSurfaceFormat;
-        imageViewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageViewInfo.subresourceRange.baseMipLevel = 0;
-        imageViewInfo.subresourceRange.levelCount = 1;
-        imageViewInfo.subresourceRange.baseArrayLayer = 0;
-        imageViewInfo.subresourceRange.layerCount = 1;
-        imageViewInfo.image = offscreenBuffer;
-        imageViewInfo.components.r = VK_COMPONENT_SWIZZLE_R;
-        imageViewInfo.components.g = VK_COMPONENT_SWIZZLE_G;
-        imageViewInfo.components.b = VK_COMPONENT_SWIZZLE_B;
-        imageViewInfo.components.a = VK_COMPONENT_SWIZZLE_A;
+    // accumulation image
+    {
+        std::cout << "Creating Accumulation Image.." << std::endl;
 
-        ASSERT_VK_RESULT(vkCreateImageView(device, &imageViewInfo, nullptr, &offscreenBufferView));
+        CreateStorageImage(VK_FORMAT_R32G32B32A32_SFLOAT, 0, GetTraceImageExtent(),
+                           accumulationImage, accumulationImageMemory, accumulationImageView);
     }
 
     // rt descriptor set layout
@@ -917,8 +4370,15 @@ int main() {
         storageImageLayoutBinding.descriptorCount = 1;
         storageImageLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 
-        std::vector<VkDescriptorSetLayoutBinding> bindings(
-            {accelerationStructureLayoutBinding, storageImageLayoutBinding});
+        VkDescriptorSetLayoutBinding accumulationImageLayoutBinding = {};
+        accumulationImageLayoutBinding.binding = 2;
+        accumulationImageLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        accumulationImageLayoutBinding.descriptorCount = 1;
+        accumulationImageLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
+
+        std::vector<VkDescriptorSetLayoutBinding> bindings({accelerationStructureLayoutBinding,
+                                                            storageImageLayoutBinding,
+                                                            accumulationImageLayoutBinding});
 
         VkDescriptorSetLayoutCreateInfo layoutInfo = {};
         layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -933,61 +4393,7 @@ int main() {
     {
         std::cout << "Creating RT Descriptor Set.." << std::endl;
 
-        std::vector<VkDescriptorPoolSize> poolSizes(
-            {{VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1},
-             {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1}});
-
-        VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
-        descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        descriptorPoolInfo.maxSets = 1;
-        descriptorPoolInfo.poolSizeCount = (uint32_t)poolSizes.size();
-        descriptorPoolInfo.pPoolSizes = poolSizes.data();
-
-        ASSERT_VK_RESULT(
-            vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
-
-        VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
-        descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        descriptorSetAllocateInfo.descriptorPool = descriptorPool;
-        descriptorSetAllocateInfo.descriptorSetCount = 1;
-        descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
-
-        ASSERT_VK_RESULT(
-            vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &descriptorSet));
-
-        VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo = {};
-        descriptorAccelerationStructureInfo.sType =
-            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
-        descriptorAccelerationStructureInfo.accelerationStructureCount = 1;
-        descriptorAccelerationStructureInfo.pAccelerationStructures = &topLevelAS;
-
-        VkWriteDescriptorSet accelerationStructureWrite = {};
-        accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        accelerationStructureWrite.pNext = &descriptorAccelerationStructureInfo;
-        accelerationStructureWrite.dstSet = descriptorSet;
-        accelerationStructureWrite.dstBinding = 0;
-        accelerationStructureWrite.descriptorCount = 1;
-        accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
-
-        VkDescriptorImageInfo storageImageInfo = {};
-        storageImageInfo.sampler = VK_NULL_HANDLE;
-        storageImageInfo.imageView = offscreenBufferView;
-        storageImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-
-        VkWriteDescriptorSet outputImageWrite = {};
-        outputImageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        outputImageWrite.pNext = nullptr;
-        outputImageWrite.dstSet = descriptorSet;
-        outputImageWrite.dstBinding = 1;
-        outputImageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-        outputImageWrite.descriptorCount = 1;
-        outputImageWrite.pImageInfo = &storageImageInfo;
-
-        std::vector<VkWriteDescriptorSet> descriptorWrites(
-            {accelerationStructureWrite, outputImageWrite});
-
-        vkUpdateDescriptorSets(device, (uint32_t)descriptorWrites.size(), descriptorWrites.data(),
-                               0, nullptr);
+        CreateTraceDescriptorSets({offscreenBufferView}, descriptorPool, descriptorSets);
     }
 
     // rt pipeline layout
@@ -999,6 +4405,14 @@ int main() {
         pipelineLayoutInfo.setLayoutCount = 1;
         pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
 
+        VkPushConstantRange pushConstantRange = {};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(TracePushConstants);
+
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
         ASSERT_VK_RESULT(
             vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout));
     }
@@ -1007,30 +4421,50 @@ int main() {
     {
         std::cout << "Creating RT Pipeline.." << std::endl;
 
+#ifdef EMBED_SPIRV
+        ShaderBlob rgenShaderSrc =
+            GetEmbeddedShaderBlob(rayGenerationSpv, sizeof(rayGenerationSpv));
+        ShaderBlob rchitShaderSrc =
+            GetEmbeddedShaderBlob(rayClosestHitSpv, sizeof(rayClosestHitSpv));
+        ShaderBlob rmissShaderSrc = GetEmbeddedShaderBlob(rayMissSpv, sizeof(rayMissSpv));
+#else
         std::string basePath = GetExecutablePath() + "/../../shaders";
 
-        std::vector<char> rgenShaderSrc = readFile(basePath + "/ray-generation.spv");
-        std::vector<char> rchitShaderSrc = readFile(basePath + "/ray-closest-hit.spv");
-        std::vector<char> rmissShaderSrc = readFile(basePath + "/ray-miss.spv");
+        ShaderBlob rgenShaderSrc = LoadShaderBlob(basePath + "/ray-generation.spv");
+        ShaderBlob rchitShaderSrc = LoadShaderBlob(basePath + "/ray-closest-hit.spv");
+        ShaderBlob rmissShaderSrc = LoadShaderBlob(basePath + "/ray-miss.spv");
+#endif
+
+        // the modules are independent of each other, so they are created in parallel
+        const ShaderBlob* shaderBlobs[] = {&rgenShaderSrc, &rchitShaderSrc, &rmissShaderSrc};
+        VkShaderModule shaderModules[3] = {};
+        RunParallel(threadPool, 3, [&](uint32_t taskIndex, uint32_t) {
+            shaderModules[taskIndex] = CreateShaderModule(*shaderBlobs[taskIndex]);
+        });
 
         VkPipelineShaderStageCreateInfo rayGenShaderStageInfo = {};
         rayGenShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         rayGenShaderStageInfo.stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
-        rayGenShaderStageInfo.module = CreateShaderModule(rgenShaderSrc);
+        rayGenShaderStageInfo.module = shaderModules[0];
         rayGenShaderStageInfo.pName = "main";
 
         VkPipelineShaderStageCreateInfo rayChitShaderStageInfo = {};
         rayChitShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         rayChitShaderStageInfo.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-        rayChitShaderStageInfo.module = CreateShaderModule(rchitShaderSrc);
+        rayChitShaderStageInfo.module = shaderModules[1];
         rayChitShaderStageInfo.pName = "main";
 
         VkPipelineShaderStageCreateInfo rayMissShaderStageInfo = {};
         rayMissShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         rayMissShaderStageInfo.stage = VK_SHADER_STAGE_MISS_BIT_KHR;
-        rayMissShaderStageInfo.module = CreateShaderModule(rmissShaderSrc);
+        rayMissShaderStageInfo.module = shaderModules[2];
         rayMissShaderStageInfo.pName = "main";
 
+        // the modules hold their own copy of the code
+        ReleaseShaderBlob(rgenShaderSrc);
+        ReleaseShaderBlob(rchitShaderSrc);
+        ReleaseShaderBlob(rmissShaderSrc);
+
         std::vector<VkPipelineShaderStageCreateInfo> shaderStages = {
             rayGenShaderStageInfo, rayMissShaderStageInfo, rayChitShaderStageInfo};
 
@@ -1072,36 +4506,42 @@ int main() {
 
         sbtGroupCount = shaderGroups.size();
 
-        ASSERT_VK_RESULT(vkCreateRayTracingPipelinesKHR(device, nullptr, nullptr, 1, &pipelineInfo,
-                                                        nullptr, &pipeline));
+        CreatePipelineCache(deviceProperties);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        pipeline = CreateRayTracingPipelines({pipelineInfo})[0];
+        auto end = std::chrono::high_resolution_clock::now();
+
+        std::cout << "Compiled RT Pipeline in "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << "ms on "
+                  << GetThreadCount(threadPool) << " threads ("
+                  << (pipelineCacheWarm ? "warm" : "cold") << " cache)" << std::endl;
     }
 
     // shader binding table
     {
         std::cout << "Creating Shader Binding Table.." << std::endl;
 
-        sbtHandleSize = rayTracingPipelineProperties.shaderGroupHandleSize;
-        sbtHandleAlignment = rayTracingPipelineProperties.shaderGroupHandleAlignment;
-        sbtHandleSizeAligned = alignTo(sbtHandleSize, sbtHandleAlignment);
-        sbtSize = sbtGroupCount * sbtHandleSizeAligned;
+        // group indices match the order of the shader groups in the pipeline
+        ShaderRecord rayGenRecord = {};
+        rayGenRecord.groupIndex = 0;
+
+        ShaderRecord missRecord = {};
+        missRecord.groupIndex = 1;
+
+        ShaderRecord hitRecord = {};
+        hitRecord.groupIndex = 2;
 
-        std::vector<uint8_t> sbtResults(sbtSize);
+        shaderBindingTable = CreateShaderBindingTable(rayGenRecord, {missRecord}, {hitRecord}, {});
+    }
 
-        ASSERT_VK_RESULT(vkGetRayTracingShaderGroupHandlesKHR(device, pipeline, 0, sbtGroupCount,
-                                                              sbtSize, sbtResults.data()));
+    PrintMemoryStats();
 
-        // create 3 separate buffers for each ray type
-        sbtRayGenBuffer = CreateMappedBuffer(sbtResults.data(), sbtHandleSize,
-                                             VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR |
-                                                 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-        sbtRayMissBuffer =
-            CreateMappedBuffer(sbtResults.data() + sbtHandleSizeAligned, sbtHandleSize,
-                               VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR |
-                                   VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-        sbtRayHitBuffer =
-            CreateMappedBuffer(sbtResults.data() + sbtHandleSizeAligned * 2, sbtHandleSize,
-                               VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR |
-                                   VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    if (!offlineImagePath.empty()) {
+        return RunOfflineRender();
+    }
+    if (headless) {
+        return RunHeadlessBenchmark();
     }
 
     std::cout << "Initializing Swapchain.." << std::endl;
@@ -1117,6 +4557,34 @@ int main() {
     bool isMailboxModeSupported = std::find(presentModes.begin(), presentModes.end(),
                                             VK_PRESENT_MODE_MAILBOX_KHR) != presentModes.end();
 
+    // tracing straight into the swapchain images needs them to be storage images, writing them
+    // without a format in the shader was already required at device creation
+    VkSurfaceCapabilitiesKHR surfaceCapabilities = {};
+    ASSERT_VK_RESULT(
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities));
+    VkFormatProperties surfaceFormatProperties = {};
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, desiredSurfaceFormat,
+                                        &surfaceFormatProperties);
+
+    const bool directPresentSupported =
+        (surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT) &&
+        (surfaceFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+    if (presentPath == "direct") {
+        if (!directPresentSupported) {
+            std::cout << "Swapchain images can not be storage images" << std::endl;
+            return EXIT_FAILURE;
+        }
+        directPresent = true;
+    } else if (presentPath == "auto") {
+        directPresent = directPresentSupported;
+    } else if (presentPath != "copy") {
+        std::cout << "Unknown present path " << presentPath << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << (directPresent ? "Tracing into the swapchain images"
+                                : "Copying the offscreen buffer into the swapchain images")
+              << std::endl;
+
     VkSwapchainCreateInfoKHR swapchainInfo = {};
     swapchainInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
     swapchainInfo.surface = surface;
@@ -1128,6 +4596,9 @@ int main() {
     swapchainInfo.imageArrayLayers = 1;
     swapchainInfo.imageUsage =
         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (directPresent) {
+        swapchainInfo.imageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
+    }
     swapchainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
     swapchainInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
     swapchainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
@@ -1135,16 +4606,16 @@ int main() {
         isMailboxModeSupported ? VK_PRESENT_MODE_MAILBOX_KHR : VK_PRESENT_MODE_FIFO_KHR;
     swapchainInfo.clipped = VK_TRUE;
 
-    ASSERT_VK_RESULT(vkCreateSwapchainKHR(device, &swapchainInfo, nullptr, &swapchain));
+    ASSERT_VK_RESULT(ext::vkCreateSwapchainKHR(device, &swapchainInfo, nullptr, &swapchain));
 
     uint32_t amountOfImagesInSwapchain = 0;
-    vkGetSwapchainImagesKHR(device, swapchain, &amountOfImagesInSwapchain, nullptr);
-    std::vector<VkImage> swapchainImages(amountOfImagesInSwapchain);
+    ext::vkGetSwapchainImagesKHR(device, swapchain, &amountOfImagesInSwapchain, nullptr);
+    swapchainImages.resize(amountOfImagesInSwapchain);
 
-    ASSERT_VK_RESULT(vkGetSwapchainImagesKHR(device, swapchain, &amountOfImagesInSwapchain,
-                                             swapchainImages.data()));
+    ASSERT_VK_RESULT(ext::vkGetSwapchainImagesKHR(device, swapchain, &amountOfImagesInSwapchain,
+                                                  swapchainImages.data()));
 
-    std::vector<VkImageView> imageViews(amountOfImagesInSwapchain);
+    swapchainImageViews.resize(amountOfImagesInSwapchain);
 
     for (uint32_t ii = 0; ii < amountOfImagesInSwapchain; ++ii) {
         VkImageViewCreateInfo imageViewInfo = {};
@@ -1158,119 +4629,25 @@ int main() {
         imageViewInfo.subresourceRange.baseArrayLayer = 0;
         imageViewInfo.subresourceRange.layerCount = 1;
 
-        ASSERT_VK_RESULT(vkCreateImageView(device, &imageViewInfo, nullptr, &imageViews[ii]));
-    };
-
-    std::cout << "Recording frame commands.." << std::endl;
-
-    VkImageCopy copyRegion = {};
-    copyRegion.srcOffset = {0, 0, 0};
-    copyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    copyRegion.srcSubresource.mipLevel = 0;
-    copyRegion.srcSubresource.baseArrayLayer = 0;
-    copyRegion.srcSubresource.layerCount = 1;
-    copyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    copyRegion.dstSubresource.mipLevel = 0;
-    copyRegion.dstSubresource.baseArrayLayer = 0;
-    copyRegion.dstSubresource.layerCount = 1;
-    copyRegion.extent.depth = 1;
-    copyRegion.extent.width = desiredWindowWidth;
-    copyRegion.extent.height = desiredWindowHeight;
-    copyRegion.dstOffset = {0, 0, 0};
-
-    VkImageSubresourceRange subresourceRange = {};
-    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    subresourceRange.baseMipLevel = 0;
-    subresourceRange.levelCount = 1;
-    subresourceRange.baseArrayLayer = 0;
-    subresourceRange.layerCount = 1;
-
-    VkStridedDeviceAddressRegionKHR rayGenSBT = {};
-    rayGenSBT.deviceAddress = sbtRayGenBuffer.deviceAddress;
-    rayGenSBT.stride = sbtHandleSizeAligned;
-    rayGenSBT.size = sbtHandleSizeAligned;
-
-    VkStridedDeviceAddressRegionKHR rayMissSBT = {};
-    rayMissSBT.deviceAddress = sbtRayMissBuffer.deviceAddress;
-    rayMissSBT.stride = sbtHandleSizeAligned;
-    rayMissSBT.size = sbtHandleSizeAligned;
-
-    VkStridedDeviceAddressRegionKHR rayHitSBT = {};
-    rayHitSBT.deviceAddress = sbtRayHitBuffer.deviceAddress;
-    rayHitSBT.stride = sbtHandleSizeAligned;
-    rayHitSBT.size = sbtHandleSizeAligned;
-
-    VkStridedDeviceAddressRegionKHR rayCallableSBT = {};
-
-    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    commandBufferAllocateInfo.commandPool = commandPool;
-    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    commandBufferAllocateInfo.commandBufferCount = amountOfImagesInSwapchain;
-
-    std::vector<VkCommandBuffer> commandBuffers =
-        std::vector<VkCommandBuffer>(amountOfImagesInSwapchain);
-
-    ASSERT_VK_RESULT(
-        vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, commandBuffers.data()));
-
-    VkCommandBufferBeginInfo commandBufferBeginInfo = {};
-    commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    commandBufferBeginInfo.flags = 0;
-
-    for (uint32_t ii = 0; ii < amountOfImagesInSwapchain; ++ii) {
-        VkCommandBuffer commandBuffer = commandBuffers[ii];
-        VkImage swapchainImage = swapchainImages[ii];
-
-        ASSERT_VK_RESULT(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
-
-        // transition offscreen buffer into shader writeable state
-        InsertCommandImageBarrier(commandBuffer, offscreenBuffer, 0, VK_ACCESS_SHADER_WRITE_BIT,
-                                  VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
-                                  subresourceRange);
-
-        // record ray tracing
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-                                pipelineLayout, 0, 1, &descriptorSet, 0, 0);
-
-        vkCmdTraceRaysKHR(commandBuffer, &rayGenSBT, &rayMissSBT, &rayHitSBT, &rayCallableSBT,
-                          desiredWindowWidth, desiredWindowHeight, 1);
-
-        // transition swapchain image into copy destination state
-        InsertCommandImageBarrier(commandBuffer, swapchainImage, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
-                                  VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                                  subresourceRange);
-
-        // transition offscreen buffer into copy source state
-        InsertCommandImageBarrier(commandBuffer, offscreenBuffer, VK_ACCESS_SHADER_WRITE_BIT,
-                                  VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL,
-                                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange);
-
-        // copy offscreen buffer into swapchain image
-        vkCmdCopyImage(commandBuffer, offscreenBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                       swapchainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-
-        // transition swapchain image into presentable state
-        InsertCommandImageBarrier(commandBuffer, swapchainImage, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
-                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                                  VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, subresourceRange);
-
-        ASSERT_VK_RESULT(vkEndCommandBuffer(commandBuffer));
+        ASSERT_VK_RESULT(
+            vkCreateImageView(device, &imageViewInfo, nullptr, &swapchainImageViews[ii]));
     };
 
-    VkSemaphoreCreateInfo semaphoreInfo = {};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    if (directPresent) {
+        CreateTraceDescriptorSets(swapchainImageViews, presentDescriptorPool,
+                                  presentDescriptorSets);
+    }
 
-    ASSERT_VK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphoreImageAvailable));
+    std::cout << "Creating frame resources.." << std::endl;
 
-    ASSERT_VK_RESULT(
-        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphoreRenderingAvailable));
+    CreateFrameResources();
 
     std::cout << "Done!" << std::endl;
     std::cout << "Drawing.." << std::endl;
 
+#ifdef _WIN32
     MSG msg;
+    uint32_t frameIndex = 0;
     bool quitMessageReceived = false;
     while (!quitMessageReceived) {
         while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
@@ -1282,37 +4659,58 @@ int main() {
             }
         }
         if (!quitMessageReceived) {
+            FrameResources& frame = frames[frameIndex % framesInFlight];
+
+            // only block once the GPU falls more than framesInFlight frames behind
+            WaitForSubmission(mainTimeline, frame.submitValue);
+            CollectDeferredReleases(false);
+
             uint32_t imageIndex = 0;
             ASSERT_VK_RESULT(vkAcquireNextImageKHR(device, swapchain, UINT64_MAX,
-                                                   semaphoreImageAvailable, nullptr, &imageIndex));
+                                                   frame.semaphoreImageAvailable, nullptr,
+                                                   &imageIndex));
 
-            VkPipelineStageFlags waitStageMasks[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+            ResolveGpuProfilerFrame(frameIndex % framesInFlight, false);
+            ResolveAsyncOverlap(frameIndex % framesInFlight);
 
-            VkSubmitInfo submitInfo = {};
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.waitSemaphoreCount = 1;
-            submitInfo.pWaitSemaphores = &semaphoreImageAvailable;
-            submitInfo.pWaitDstStageMask = waitStageMasks;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-            submitInfo.signalSemaphoreCount = 1;
-            submitInfo.pSignalSemaphores = &semaphoreRenderingAvailable;
+            if (frameIndex > 0 && frameIndex % gpuProfilerPrintInterval == 0) {
+                PrintGpuProfilerStats();
+                PrintAsyncOverlapStats();
+            }
+
+            // the wait guarantees that the instance buffer of this ring slot is no longer read
+            if (animateInstances) {
+                WriteAnimatedInstances(
+                    GetFrameTopLevelAccelerationStructure(frameIndex % framesInFlight),
+                    frameIndex % framesInFlight, frameIndex);
+            }
+            RecordFrameCommands(frame, imageIndex, frameIndex);
 
-            ASSERT_VK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, nullptr));
+            SubmitFrame(frame, frame.semaphoreImageAvailable, frame.semaphoreRenderingAvailable);
 
             VkPresentInfoKHR presentInfo = {};
             presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
             presentInfo.waitSemaphoreCount = 1;
-            presentInfo.pWaitSemaphores = &semaphoreRenderingAvailable;
+            presentInfo.pWaitSemaphores = &frame.semaphoreRenderingAvailable;
             presentInfo.swapchainCount = 1;
             presentInfo.pSwapchains = &swapchain;
             presentInfo.pImageIndices = &imageIndex;
 
             ASSERT_VK_RESULT(vkQueuePresentKHR(queue, &presentInfo));
 
-            ASSERT_VK_RESULT(vkQueueWaitIdle(queue));
+            ++frameIndex;
         }
     }
 
+    ASSERT_VK_RESULT(vkDeviceWaitIdle(device));
+    DestroyFrameResources();
+    DestroyGpuProfiler();
+    DestroyPipelineCache();
+    DestroyTopLevelAccelerationStructures();
+    DestroyScratchPool();
+    DestroySubmissionTimelines();
+    DestroyThreadPool(threadPool);
+#endif
+
     return EXIT_SUCCESS;
 }
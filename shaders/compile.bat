@@ -1,3 +1,6 @@
 start "" /d "%cd%" "%VULKAN_SDK%/bin/glslangValidator" --target-env vulkan1.2 -V ray-generation.rgen   -o ray-generation.spv
 start "" /d "%cd%" "%VULKAN_SDK%/bin/glslangValidator" --target-env vulkan1.2 -V ray-closest-hit.rchit -o ray-closest-hit.spv
 start "" /d "%cd%" "%VULKAN_SDK%/bin/glslangValidator" --target-env vulkan1.2 -V ray-miss.rmiss        -o ray-miss.spv
+start "" /d "%cd%" "%VULKAN_SDK%/bin/glslangValidator" --target-env vulkan1.2 -V ray-generation.rgen   --vn rayGenerationSpv -o ray-generation.spv.h
+start "" /d "%cd%" "%VULKAN_SDK%/bin/glslangValidator" --target-env vulkan1.2 -V ray-closest-hit.rchit --vn rayClosestHitSpv -o ray-closest-hit.spv.h
+start "" /d "%cd%" "%VULKAN_SDK%/bin/glslangValidator" --target-env vulkan1.2 -V ray-miss.rmiss        --vn rayMissSpv       -o ray-miss.spv.h
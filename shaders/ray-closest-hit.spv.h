@@ -0,0 +1,30 @@
+	 #pragma once
+const uint32_t rayClosestHitSpv[] = {
+	0x07230203,0x00010500,0x0008000a,0x00000025,0x00000000,0x00020011,0x0000117f,0x0006000a,
+	0x5f565053,0x5f52484b,0x5f796172,0x63617274,0x00676e69,0x0006000b,0x00000001,0x4c534c47,
+	0x6474732e,0x3035342e,0x00000000,0x0003000e,0x00000000,0x00000001,0x0007000f,0x000014c4,
+	0x00000004,0x6e69616d,0x00000000,0x0000000c,0x0000001e,0x00030003,0x00000002,0x000001cc,
+	0x00060004,0x455f4c47,0x725f5458,0x745f7961,0x69636172,0x0000676e,0x00040005,0x00000004,
+	0x6e69616d,0x00000000,0x00040005,0x00000009,0x79726162,0x00000000,0x00040005,0x0000000c,
+	0x72747461,0x00736269,0x00040005,0x0000001e,0x6c796170,0x0064616f,0x00040047,0x0000001e,
+	0x0000001e,0x00000000,0x00020013,0x00000002,0x00030021,0x00000003,0x00000002,0x00030016,
+	0x00000006,0x00000020,0x00040017,0x00000007,0x00000006,0x00000003,0x00040020,0x00000008,
+	0x00000007,0x00000007,0x0004002b,0x00000006,0x0000000a,0x3f800000,0x00040020,0x0000000b,
+	0x000014db,0x00000007,0x0004003b,0x0000000b,0x0000000c,0x000014db,0x00040015,0x0000000d,
+	0x00000020,0x00000000,0x0004002b,0x0000000d,0x0000000e,0x00000000,0x00040020,0x0000000f,
+	0x000014db,0x00000006,0x0004002b,0x0000000d,0x00000013,0x00000001,0x00040017,0x0000001c,
+	0x00000006,0x00000004,0x00040020,0x0000001d,0x000014de,0x0000001c,0x0004003b,0x0000001d,
+	0x0000001e,0x000014de,0x0004002b,0x00000006,0x00000020,0x00000000,0x00050036,0x00000002,
+	0x00000004,0x00000000,0x00000003,0x000200f8,0x00000005,0x0004003b,0x00000008,0x00000009,
+	0x00000007,0x00050041,0x0000000f,0x00000010,0x0000000c,0x0000000e,0x0004003d,0x00000006,
+	0x00000011,0x00000010,0x00050083,0x00000006,0x00000012,0x0000000a,0x00000011,0x00050041,
+	0x0000000f,0x00000014,0x0000000c,0x00000013,0x0004003d,0x00000006,0x00000015,0x00000014,
+	0x00050083,0x00000006,0x00000016,0x00000012,0x00000015,0x00050041,0x0000000f,0x00000017,
+	0x0000000c,0x0000000e,0x0004003d,0x00000006,0x00000018,0x00000017,0x00050041,0x0000000f,
+	0x00000019,0x0000000c,0x00000013,0x0004003d,0x00000006,0x0000001a,0x00000019,0x00060050,
+	0x00000007,0x0000001b,0x00000016,0x00000018,0x0000001a,0x0003003e,0x00000009,0x0000001b,
+	0x0004003d,0x00000007,0x0000001f,0x00000009,0x00050051,0x00000006,0x00000021,0x0000001f,
+	0x00000000,0x00050051,0x00000006,0x00000022,0x0000001f,0x00000001,0x00050051,0x00000006,
+	0x00000023,0x0000001f,0x00000002,0x00070050,0x0000001c,0x00000024,0x00000021,0x00000022,
+	0x00000023,0x00000020,0x0003003e,0x0000001e,0x00000024,0x000100fd,0x00010038
+};